@@ -1,112 +1,420 @@
 #include "filesys/cache.h"
+#include <stdio.h>
 #include <string.h>
+#include <round.h>
 #include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 
+/* cache entries indexed by sector_index, for O(1) lookup */
+static struct hash cache_table;
+
+/* preallocated cache entries, headers are kept apart from data */
+static struct cache_entry cache_entries[MAX_CACHE_SIZE];
+
+/* sector data of cache entries, packed PGSIZE / BLOCK_SECTOR_SIZE per page */
+static uint8_t *cache_data;
+
+/* cache entries not holding any sector */
+static struct list cache_free_list;
+
+/* dirty cache entries, in ascending order of sector_index */
+static struct list cache_dirty_list;
+
+/* signaled when pin count of an entry drops to zero */
+static struct condition cache_unpinned;
+
+/* queue of blocks to read ahead, one up of read_ahead_sema per block */
+static struct list read_ahead_list;
+static struct lock read_ahead_lock;
+static struct semaphore read_ahead_sema;
+static size_t read_ahead_cnt;
+
+/* replacement policy, clock by default */
+enum cache_policy cache_policy = CACHE_CLOCK;
+
+/* if true, metadata blocks are evicted after data blocks */
+bool cache_meta_priority;
+
+/* clock hand for CACHE_CLOCK, next entry to inspect */
+static struct list_elem *clock_hand;
+
+/* statistics */
+static long long cache_hit_cnt;
+static long long cache_miss_cnt;
+static long long cache_evict_cnt;
+
+static struct cache_entry *cache_lookup(block_sector_t index);
+static struct cache_entry *cache_insert(block_sector_t index, bool *hit);
+static struct cache_entry *cache_find_victim_among(bool meta);
+static bool cache_dirty_less(const struct list_elem *a_, const struct list_elem *b_, void *aux);
 
 /* init cache and lock */
 void cache_init(void){
   list_init(&cache);
+  hash_init(&cache_table, cache_hash, cache_less, NULL);
+  clock_hand = NULL;
+  // allocate data pages of all entries at once
+  size_t page_cnt = DIV_ROUND_UP(MAX_CACHE_SIZE * BLOCK_SECTOR_SIZE, PGSIZE);
+  cache_data = palloc_get_multiple(PAL_ASSERT, page_cnt);
+  list_init(&cache_free_list);
+  list_init(&cache_dirty_list);
+  unsigned i;
+  for(i=0; i<MAX_CACHE_SIZE; i++){
+    struct cache_entry *c = &cache_entries[i];
+    c->data = cache_data + i * BLOCK_SECTOR_SIZE;
+    c->pin_cnt = 0;
+    rwlock_init(&c->rwlock);
+    list_push_back(&cache_free_list, &c->elem);
+  }
   lock_init(&cache_lock);
+  cond_init(&cache_unpinned);
   // for read ahead and write behind
   list_init(&read_ahead_list);
+  lock_init(&read_ahead_lock);
+  sema_init(&read_ahead_sema, 0);
+  read_ahead_cnt = 0;
   thread_create("cache_write_behind", 0, thread_func_write_behind, NULL);
   thread_create("cache_read_ahead", 0, thread_func_read_ahead, NULL);
 }
 
 
-/* get cache block
-  if cache is full, evict */
-struct cache_entry *cache_get_block(block_sector_t index){
-  lock_acquire(&cache_lock);
-  size_t cache_size = list_size(&cache);
-  //if cache is full -> remove victim
-  if(cache_size >= MAX_CACHE_SIZE){
-    struct cache_entry *victim = cache_find_victim();
-    if(victim->dirty){
-      block_write(fs_device, victim->sector_index, &victim->data);
+/* find or insert cache block of index, cache_lock must be held
+  if cache is full, evict and reuse the victim
+  returned block is pinned, and *hit tells whether it was cached
+  newly inserted block is returned locked exclusive with invalid data
+  lookup and insertion are done under one cache_lock, so
+  concurrent misses on index share one block and one disk read */
+static struct cache_entry *cache_insert(block_sector_t index, bool *hit){
+  struct cache_entry *c;
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+  while(true){
+    // if other thread has cached it (or is reading it), share it
+    c = cache_lookup(index);
+    if(c){
+      *hit = true;
+      return c;
+    }
+    // if free entry available
+    if(!list_empty(&cache_free_list)){
+      c = list_entry(list_pop_front(&cache_free_list), struct cache_entry, elem);
+      break;
     }
-    list_remove(&victim->elem);
-    free(victim);
+    //if cache is full -> remove victim
+    c = cache_find_victim();
+    if(c){
+      if(c->dirty){
+        block_write(fs_device, c->sector_index, c->data);
+        list_remove(&c->dirty_elem);
+      }
+      list_remove(&c->elem);
+      hash_delete(&cache_table, &c->hash_elem);
+      cache_evict_cnt++;
+      break;
+    }
+    // wait until some block is unpinned, then look up again
+    cond_wait(&cache_unpinned, &cache_lock);
   }
-  struct cache_entry *c = malloc(sizeof(struct cache_entry));
-  block_read(fs_device, index, &c->data);
   c->sector_index = index;
   c->valid = false;
   c->dirty = false;
+  c->accessed = true;
+  c->meta = false;
+  c->pin_cnt = 1;
   list_push_front(&cache, &c->elem);
+  hash_insert(&cache_table, &c->hash_elem);
+  cache_miss_cnt++;
+  // hold block exclusive while in flight, others wait on rwlock
+  // unpinned block is never locked, so this does not sleep
+  rwlock_acquire_write(&c->rwlock);
+  *hit = false;
+  return c;
+}
+
+
+/* get cache block, reading it from disk if not cached
+  returned block is pinned, caller must unpin it */
+struct cache_entry *cache_get_block(block_sector_t index){
+  bool hit;
+  lock_acquire(&cache_lock);
+  struct cache_entry *c = cache_insert(index, &hit);
   lock_release(&cache_lock);
+  if(!hit){
+    block_read(fs_device, index, c->data);
+    c->valid = true;
+    rwlock_release(&c->rwlock);
+  }
   return c;
 }
 
 
-/* read data from block
-  if cache is available, read from cache
-  else, make cache */
-void cache_read(block_sector_t index, void *buffer){
-  struct cache_entry *c = cache_find_block(index);
-  // if cache available
-  if(c){
-    memcpy(buffer, &c->data, BLOCK_SECTOR_SIZE);
+/* get pinned cache block of index locked exclusive, for caller
+  overwriting all BLOCK_SECTOR_SIZE bytes of it
+  if not cached, the disk read is skipped
+  caller must call cache_release(c, true) after writing */
+struct cache_entry *cache_acquire_overwrite(block_sector_t index){
+  bool hit;
+  lock_acquire(&cache_lock);
+  struct cache_entry *c = cache_insert(index, &hit);
+  lock_release(&cache_lock);
+  if(hit){
+    rwlock_acquire_write(&c->rwlock);
   }
-  // if no cache
   else{
-    //make cache and read from it
-    c = cache_get_block(index);
-    memcpy(buffer, &c->data, BLOCK_SECTOR_SIZE);
-    // add read ahead
-    struct read_ahead_entry *rae = malloc(sizeof(struct read_ahead_entry));
-    rae->sector_index = index+1;
-    list_push_back(&read_ahead_list, &rae->elem);
+    c->valid = true;
   }
+  return c;
 }
 
 
-/* write data to block
-  if cache is available, write data to cache
-  else, make cache */
-void cache_write(block_sector_t index, const void *buffer){
-  struct cache_entry *c = cache_find_block(index);
-  // if cache available
-  if(c){
-    memcpy(&c->data, buffer, BLOCK_SECTOR_SIZE);
-    c->dirty = true;
+/* get pinned cache block of index and lock it
+  shared for reading, exclusive for writing
+  caller must call cache_release after access */
+struct cache_entry *cache_acquire(block_sector_t index, bool exclusive){
+  struct cache_entry *c = cache_get_block(index);
+  if(exclusive){
+    rwlock_acquire_write(&c->rwlock);
   }
-  // if no cache
   else{
-    // get cache and write data
-    c = cache_get_block(index);
-    memcpy(&c->data, buffer, BLOCK_SECTOR_SIZE);
+    rwlock_acquire_read(&c->rwlock);
+  }
+  return c;
+}
+
+
+/* unlock and unpin cache block from cache_acquire
+  if dirty, caller has modified the data */
+void cache_release(struct cache_entry *c, bool dirty){
+  ASSERT(!dirty || rwlock_held_by_current_thread(&c->rwlock));
+  rwlock_release(&c->rwlock);
+  lock_acquire(&cache_lock);
+  // mark dirty before unpinning, so victim is never dirty but unlisted
+  if(dirty && !c->dirty){
     c->dirty = true;
+    list_insert_ordered(&cache_dirty_list, &c->dirty_elem, cache_dirty_less, NULL);
   }
+  ASSERT(c->pin_cnt > 0);
+  c->pin_cnt--;
+  if(c->pin_cnt == 0){
+    cond_signal(&cache_unpinned, &cache_lock);
+  }
+  lock_release(&cache_lock);
 }
 
 
-/* find cache by block index
+/* unpin cache block, so it can be evicted again */
+void cache_unpin(struct cache_entry *c){
+  lock_acquire(&cache_lock);
+  ASSERT(c->pin_cnt > 0);
+  c->pin_cnt--;
+  if(c->pin_cnt == 0){
+    cond_signal(&cache_unpinned, &cache_lock);
+  }
+  lock_release(&cache_lock);
+}
+
+
+/* read file system metadata (inode, indirect block) from block */
+void cache_read_meta(block_sector_t index, void *buffer){
+  struct cache_entry *c = cache_acquire(index, false);
+  c->meta = true;
+  memcpy(buffer, c->data, BLOCK_SECTOR_SIZE);
+  cache_release(c, false);
+}
+
+
+/* write file system metadata (inode, indirect block) to block */
+void cache_write_meta(block_sector_t index, const void *buffer){
+  struct cache_entry *c = cache_acquire_overwrite(index);
+  c->meta = true;
+  memcpy(c->data, buffer, BLOCK_SECTOR_SIZE);
+  cache_release(c, true);
+}
+
+
+/* Returns a hash value for cache c. */
+unsigned cache_hash(const struct hash_elem *c_, void *aux UNUSED){
+  const struct cache_entry *c = hash_entry(c_, struct cache_entry, hash_elem);
+  return hash_int(c->sector_index);
+}
+
+
+/* Returns true if cache a precedes cache b. */
+bool cache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct cache_entry *a = hash_entry(a_, struct cache_entry, hash_elem);
+  const struct cache_entry *b = hash_entry(b_, struct cache_entry, hash_elem);
+  return a->sector_index < b->sector_index;
+}
+
+
+/* find cache by block index and pin it, cache_lock must be held
   if there is no cache block, return NULL */
-struct cache_entry *cache_find_block(block_sector_t index){
+static struct cache_entry *cache_lookup(block_sector_t index){
+  struct cache_entry c;
+  struct hash_elem *e;
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+  c.sector_index = index;
+  e = hash_find(&cache_table, &c.hash_elem);
+  if(e == NULL){
+    return NULL;
+  }
+  // hit -> give second chance
+  struct cache_entry *found = hash_entry(e, struct cache_entry, hash_elem);
+  found->accessed = true;
+  found->pin_cnt++;
+  cache_hit_cnt++;
+  return found;
+}
+
+
+/* get victim of cache
+  victim is still in cache list, caller removes it
+  pinned blocks are never chosen, if all are pinned return NULL
+  with cache_meta_priority, metadata is chosen only if no data block can be */
+struct cache_entry *cache_find_victim(void){
+  if(cache_meta_priority){
+    struct cache_entry *c = cache_find_victim_among(false);
+    if(c){
+      return c;
+    }
+  }
+  return cache_find_victim_among(true);
+}
+
+
+/* get victim of cache by replacement policy
+  metadata blocks are considered only if META */
+static struct cache_entry *cache_find_victim_among(bool meta){
   struct list_elem *e;
-  lock_acquire(&cache_lock);
-  for(e=list_begin(&cache); e!=list_end(&cache); e=list_next(e)){
-    struct cache_entry *c = list_entry(e, struct cache_entry, elem);
-    if(c->sector_index == index){
-      lock_release(&cache_lock);
+  // FIFO : oldest unpinned block from the back
+  if(cache_policy == CACHE_FIFO){
+    for(e=list_rbegin(&cache); e!=list_rend(&cache); e=list_prev(e)){
+      struct cache_entry *c = list_entry(e, struct cache_entry, elem);
+      if(c->pin_cnt == 0 && (meta || !c->meta)){
+        return c;
+      }
+    }
+    return NULL;
+  }
+  // CLOCK : sweep until unpinned block without accessed bit
+  // two rounds clear every accessed bit, so stop after that
+  unsigned i;
+  for(i=0; i<2*MAX_CACHE_SIZE+1; i++){
+    if(clock_hand == NULL || clock_hand == list_end(&cache)){
+      clock_hand = list_begin(&cache);
+    }
+    struct cache_entry *c = list_entry(clock_hand, struct cache_entry, elem);
+    clock_hand = list_next(clock_hand);
+    if(c->pin_cnt > 0 || (!meta && c->meta)){
+      continue;
+    }
+    if(!c->accessed){
       return c;
     }
+    c->accessed = false;
   }
-  lock_release(&cache_lock);
   return NULL;
 }
 
 
-/* get victim of cache */
-// FIFO
-struct cache_entry *cache_find_victim(void){
-  struct list_elem *e = list_pop_back(&cache);
-  struct cache_entry *victim = list_entry(e, struct cache_entry, elem);
-  return victim;
+/* print cache statistics */
+void cache_print_stats(void){
+  printf("Cache: %lld hits, %lld misses, %lld evictions (%s)\n",
+         cache_hit_cnt, cache_miss_cnt, cache_evict_cnt,
+         cache_policy == CACHE_CLOCK ? "clock" : "fifo");
+}
+
+
+/* returns true if block of index is in cache, without pinning it */
+static bool cache_contains(block_sector_t index){
+  struct cache_entry c;
+  c.sector_index = index;
+  lock_acquire(&cache_lock);
+  bool found = hash_find(&cache_table, &c.hash_elem) != NULL;
+  lock_release(&cache_lock);
+  return found;
+}
+
+
+/* queue block of index for read ahead thread
+  blocks already cached or queued, and requests over a full queue are dropped */
+void cache_read_ahead(block_sector_t index){
+  if(cache_contains(index)){
+    return;
+  }
+  lock_acquire(&read_ahead_lock);
+  if(read_ahead_cnt >= READ_AHEAD_QUEUE_SIZE){
+    lock_release(&read_ahead_lock);
+    return;
+  }
+  struct list_elem *e;
+  for(e=list_begin(&read_ahead_list); e!=list_end(&read_ahead_list); e=list_next(e)){
+    if(list_entry(e, struct read_ahead_entry, elem)->sector_index == index){
+      lock_release(&read_ahead_lock);
+      return;
+    }
+  }
+  struct read_ahead_entry *rae = malloc(sizeof(struct read_ahead_entry));
+  if(rae == NULL){
+    lock_release(&read_ahead_lock);
+    return;
+  }
+  rae->sector_index = index;
+  list_push_back(&read_ahead_list, &rae->elem);
+  read_ahead_cnt++;
+  lock_release(&read_ahead_lock);
+  // wake up read ahead thread
+  sema_up(&read_ahead_sema);
+}
+
+
+/* Returns true if dirty cache a precedes dirty cache b. */
+static bool cache_dirty_less(const struct list_elem *a_, const struct list_elem *b_, void *aux UNUSED){
+  const struct cache_entry *a = list_entry(a_, struct cache_entry, dirty_elem);
+  const struct cache_entry *b = list_entry(b_, struct cache_entry, dirty_elem);
+  return a->sector_index < b->sector_index;
+}
+
+
+/* write all dirty blocks back to disk
+  dirty list is snapshot under cache_lock, and blocks are written
+  in ascending sector order without holding cache_lock */
+void cache_flush(void){
+  struct cache_entry *snapshot[MAX_CACHE_SIZE];
+  size_t cnt = 0;
+  size_t i;
+
+  // pin dirty blocks so they stay while cache_lock is released
+  lock_acquire(&cache_lock);
+  struct list_elem *e;
+  for(e=list_begin(&cache_dirty_list); e!=list_end(&cache_dirty_list); e=list_next(e)){
+    struct cache_entry *c = list_entry(e, struct cache_entry, dirty_elem);
+    c->pin_cnt++;
+    snapshot[cnt++] = c;
+  }
+  lock_release(&cache_lock);
+
+  for(i=0; i<cnt; i++){
+    struct cache_entry *c = snapshot[i];
+    // rwlock keeps writers out while writing
+    rwlock_acquire_read(&c->rwlock);
+    lock_acquire(&cache_lock);
+    bool dirty = c->dirty;
+    if(dirty){
+      c->dirty = false;
+      list_remove(&c->dirty_elem);
+    }
+    lock_release(&cache_lock);
+    if(dirty){
+      block_write(fs_device, c->sector_index, c->data);
+    }
+    rwlock_release(&c->rwlock);
+    cache_unpin(c);
+  }
 }
 
 
@@ -114,39 +422,29 @@ struct cache_entry *cache_find_victim(void){
 void thread_func_write_behind(void *aux UNUSED){
   while(true){
     timer_sleep(WRITE_BEHIND_PERIOD); //sleep
-    //synchronize dirty cache
-    lock_acquire(&cache_lock);
-    struct list_elem *e;
-    for(e=list_begin(&cache); e!=list_end(&cache); e=list_next(e)){
-      struct cache_entry *c = list_entry(e, struct cache_entry, elem);
-      if(c->dirty){
-        block_write(fs_device, c->sector_index, &c->data);
-        c->dirty = false;
-      }
-    }
-    lock_release(&cache_lock);
+    //snapshot lengths of extended inodes, write dirty free map sectors into
+    //cache, synchronize dirty cache, then put the lengths into cache for
+    //the next period
+    inode_sync();
   }
 }
 
 
-/* for read ahead thread */
+/* for read ahead thread
+  sleeps until a block is queued, then caches it */
 void thread_func_read_ahead(void *aux UNUSED){
   while(true){
-    timer_sleep(READ_AHEAD_PERIOD); // sleep
-    // if there is read ahead tasks
-    if(!list_empty(&read_ahead_list)){
-      // iterate through read ahead list
-      while(true){
-        // do caching and remove from the read ahead list
-        struct list_elem *e = list_pop_front(&read_ahead_list);
-        struct read_ahead_entry *rae = list_entry(e, struct read_ahead_entry, elem);
-        cache_get_block(rae->sector_index);
-        free(rae);
-        // if read ahead list is empty -> break
-        if(list_empty(&read_ahead_list)){
-          break;
-        }
-      }
+    sema_down(&read_ahead_sema);
+    // pop read ahead task
+    lock_acquire(&read_ahead_lock);
+    struct list_elem *e = list_pop_front(&read_ahead_list);
+    read_ahead_cnt--;
+    lock_release(&read_ahead_lock);
+    struct read_ahead_entry *rae = list_entry(e, struct read_ahead_entry, elem);
+    // block may have been cached since it was queued
+    if(!cache_contains(rae->sector_index)){
+      cache_unpin(cache_get_block(rae->sector_index));
     }
+    free(rae);
   }
 }
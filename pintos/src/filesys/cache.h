@@ -1,26 +1,43 @@
 #include <list.h>
+#include <hash.h>
+#include <debug.h>
 #include "devices/block.h"
 #include "threads/synch.h"
 
 #define MAX_CACHE_SIZE 64
 #define WRITE_BEHIND_PERIOD 50
-#define READ_AHEAD_PERIOD 25
+#define READ_AHEAD_QUEUE_SIZE 64
 
 struct list cache;
 
+/* replacement policy of cache, selected at boot with -cache */
+enum cache_policy{
+  CACHE_FIFO,         /* evict oldest block */
+  CACHE_CLOCK         /* second chance with accessed bit */
+};
+
+extern enum cache_policy cache_policy;
+
+/* keep metadata over file data, selected at boot with -cache-meta */
+extern bool cache_meta_priority;
+
 struct lock cache_lock;
 
 struct cache_entry{
-  uint8_t data[BLOCK_SECTOR_SIZE];
+  uint8_t *data;                /* BLOCK_SECTOR_SIZE bytes in cache data pages */
   block_sector_t sector_index;
   bool valid;
   bool dirty;
-  struct list_elem elem;
+  bool accessed;                /* reference bit for clock replacement */
+  bool meta;                    /* holds inode or indirect block */
+  int pin_cnt;                  /* number of users, pinned block is never evicted */
+  struct rwlock rwlock;         /* shared for reading data, exclusive for writing */
+  struct list_elem elem;        /* element of cache or free list */
+  struct hash_elem hash_elem;   /* element of cache hash, keyed by sector_index */
+  struct list_elem dirty_elem;  /* element of dirty list, while dirty */
 };
 
 
-struct list read_ahead_list;
-
 struct read_ahead_entry{
   block_sector_t sector_index;
   struct list_elem elem;
@@ -30,16 +47,28 @@ struct read_ahead_entry{
 /* for cache management */
 void cache_init(void);
 struct cache_entry *cache_get_block(block_sector_t index);
-void cache_read(block_sector_t index, void *buffer);
-void cache_write(block_sector_t index, const void *buffer);
+void cache_read_meta(block_sector_t index, void *buffer);
+void cache_write_meta(block_sector_t index, const void *buffer);
+
+/* for cache access */
+struct cache_entry *cache_acquire(block_sector_t index, bool exclusive);
+struct cache_entry *cache_acquire_overwrite(block_sector_t index);
+void cache_release(struct cache_entry *c, bool dirty);
+void cache_unpin(struct cache_entry *c);
+
+/* for cache hash table */
+unsigned cache_hash(const struct hash_elem *c_, void *aux UNUSED);
+bool cache_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED);
 
 /* for cache searching */
-struct cache_entry *cache_find_block(block_sector_t index);
 struct cache_entry *cache_find_victim(void);
+void cache_print_stats(void);
 
 
 /* for write behind */
+void cache_flush(void);
 void thread_func_write_behind(void *aux);
 
 /* for read ahead */
+void cache_read_ahead(block_sector_t index);
 void thread_func_read_ahead(void *aux);
@@ -1,8 +1,11 @@
 #include "filesys/directory.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
 #include "threads/thread.h"
+#include "threads/synch.h"
 #include "threads/malloc.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
@@ -21,14 +24,168 @@ struct dir_entry
     block_sector_t inode_sector;        /* Sector number of header. */
     char name[NAME_MAX + 1];            /* Null terminated file name. */
     bool in_use;                        /* In use or free? */
+    bool is_dir;                        /* Is it a directory? */
+    uint32_t hash;                      /* hash_string() of name. */
+    off_t next;                         /* Next entry in chain, 0 if last. */
   };
 
+#define DIR_BUCKET_CNT 125        /* number of hash chains per directory */
+
+/* Index at the start of every directory, one sector long.
+   Entries follow it and never move, so that dir_readdir() can walk
+   them by offset; each in-use entry is linked into the chain of its
+   name's hash, each free one into the free list.
+   A zeroed header is an empty directory. */
+struct dir_header
+  {
+    uint32_t entry_cnt;                 /* Number of entries in use. */
+    off_t free_ofs;                     /* First free entry, 0 if none. */
+    off_t end_ofs;                      /* End of entries ever used. */
+    off_t buckets[DIR_BUCKET_CNT];      /* First entry of each chain. */
+  };
+
+#define DIR_HEADER_SIZE ((off_t) sizeof (struct dir_header))
+
+/* Number of entries read at once by dir_readdir_batch(). */
+#define DIR_BATCH_CNT (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+#define DENTRY_CACHE_SIZE 128     /* number of cached directory entries */
+
+/* Cached result of looking up NAME in directory at PARENT.
+   Negative entry, with inode_sector 0, records that NAME does not
+   exist, since sector 0 holds the free map and is never a file. */
+struct dentry
+  {
+    block_sector_t parent;              /* Sector of directory. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    block_sector_t inode_sector;        /* Sector of file, 0 if none. */
+    struct hash_elem hash_elem;         /* Element in dentry_table. */
+    struct list_elem elem;              /* Element in dentry_lru or dentry_free. */
+  };
+
+/* dentry cache, keyed by (parent, name), most recently used first */
+static struct dentry dentries[DENTRY_CACHE_SIZE];
+static struct hash dentry_table;
+static struct list dentry_lru;
+static struct list dentry_free;
+static struct lock dentry_lock;
+
+static unsigned dentry_hash(const struct hash_elem *e, void *aux);
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
+static bool dentry_lookup(block_sector_t parent, const char *name, block_sector_t *sectorp);
+static void dentry_insert(block_sector_t parent, const char *name, block_sector_t inode_sector);
+
+/* Initializes the directory entry cache. */
+void dentry_init(void){
+  size_t i;
+  hash_init(&dentry_table, dentry_hash, dentry_less, NULL);
+  list_init(&dentry_lru);
+  list_init(&dentry_free);
+  lock_init(&dentry_lock);
+  for(i = 0; i < DENTRY_CACHE_SIZE; i++){
+    list_push_back(&dentry_free, &dentries[i].elem);
+  }
+}
+
+/* Returns a hash value for dentry, by parent and name. */
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED){
+  const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+  return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+/* Returns true if dentry a precedes dentry b. */
+static bool dentry_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct dentry *a = hash_entry(a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry(b_, struct dentry, hash_elem);
+  if(a->parent != b->parent){
+    return a->parent < b->parent;
+  }
+  return strcmp(a->name, b->name) < 0;
+}
+
+/* find cached lookup of name in directory at parent
+  returns false on miss, else sets *sectorp, 0 if name does not exist */
+static bool dentry_lookup(block_sector_t parent, const char *name, block_sector_t *sectorp){
+  struct dentry key;
+  struct hash_elem *e;
+
+  if(strlen(name) > NAME_MAX){
+    return false;
+  }
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  lock_acquire(&dentry_lock);
+  e = hash_find(&dentry_table, &key.hash_elem);
+  if(e != NULL){
+    struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    list_remove(&d->elem);
+    list_push_front(&dentry_lru, &d->elem);
+    *sectorp = d->inode_sector;
+  }
+  lock_release(&dentry_lock);
+  return e != NULL;
+}
+
+/* cache lookup of name in directory at parent, inode_sector 0 if it
+  does not exist, replacing an older entry or the least recently used one */
+static void dentry_insert(block_sector_t parent, const char *name, block_sector_t inode_sector){
+  struct dentry key;
+  struct dentry *d;
+  struct hash_elem *e;
+
+  if(strlen(name) > NAME_MAX){
+    return;
+  }
+  key.parent = parent;
+  strlcpy(key.name, name, sizeof key.name);
+  lock_acquire(&dentry_lock);
+  e = hash_find(&dentry_table, &key.hash_elem);
+  if(e != NULL){
+    d = hash_entry(e, struct dentry, hash_elem);
+    list_remove(&d->elem);
+  }
+  else{
+    if(!list_empty(&dentry_free)){
+      d = list_entry(list_pop_front(&dentry_free), struct dentry, elem);
+    }
+    else{
+      d = list_entry(list_pop_back(&dentry_lru), struct dentry, elem);
+      hash_delete(&dentry_table, &d->hash_elem);
+    }
+    d->parent = parent;
+    strlcpy(d->name, name, sizeof d->name);
+    hash_insert(&dentry_table, &d->hash_elem);
+  }
+  d->inode_sector = inode_sector;
+  list_push_front(&dentry_lru, &d->elem);
+  lock_release(&dentry_lock);
+}
+
+/* drop cached entries of directory at parent, called when its inode
+  is freed so that its sector can be reused by another directory
+  not when it is unlinked, since it may still be open and get entries */
+void dentry_purge(block_sector_t parent){
+  struct list_elem *e;
+  lock_acquire(&dentry_lock);
+  for(e = list_begin(&dentry_lru); e != list_end(&dentry_lru); ){
+    struct dentry *d = list_entry(e, struct dentry, elem);
+    e = list_next(e);
+    if(d->parent == parent){
+      hash_delete(&dentry_table, &d->hash_elem);
+      list_remove(&d->elem);
+      list_push_back(&dentry_free, &d->elem);
+    }
+  }
+  lock_release(&dentry_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true, parent);
+  return inode_create (sector, DIR_HEADER_SIZE + entry_cnt * sizeof (struct dir_entry),
+                       true, parent);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -85,30 +242,60 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* read offset field at ofs of directory, 0 if past end */
+static off_t dir_read_ofs(const struct dir *dir, off_t ofs){
+  off_t value;
+  if(inode_read_at(dir->inode, &value, sizeof value, ofs) != sizeof value){
+    return 0;
+  }
+  return value;
+}
+
+/* write offset field at ofs of directory */
+static bool dir_write_ofs(struct dir *dir, off_t ofs, off_t value){
+  return inode_write_at(dir->inode, &value, sizeof value, ofs) == sizeof value;
+}
+
+/* offset of header field pointing to chain of hash */
+static off_t dir_bucket_ofs(uint32_t hash){
+  return offsetof(struct dir_header, buckets) + (hash % DIR_BUCKET_CNT) * sizeof (off_t);
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   if EP is non-null, sets *OFSP to the byte offset of the
+   directory entry if OFSP is non-null, and sets *LINKP to the byte
+   offset of the field that links to the entry if LINKP is non-null.
+   otherwise, returns false and ignores EP, OFSP and LINKP. */
 static bool
 lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp)
+        struct dir_entry *ep, off_t *ofsp, off_t *linkp)
 {
   struct dir_entry e;
-  size_t ofs;
+  uint32_t hash;
+  off_t link;
+  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e){
-    if (e.in_use && !strcmp (name, e.name))
+  // only the chain of name's hash can hold it
+  hash = hash_string (name);
+  link = dir_bucket_ofs (hash);
+  for (ofs = dir_read_ofs (dir, link); ofs != 0; ofs = e.next){
+    if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+      break;
+    if (e.in_use && e.hash == hash && !strcmp (name, e.name))
       {
         if (ep != NULL)
           *ep = e;
         if (ofsp != NULL)
           *ofsp = ofs;
+        if (linkp != NULL)
+          *linkp = link;
         return true;
       }
+    link = ofs + offsetof (struct dir_entry, next);
   }
   return false;
 }
@@ -122,15 +309,27 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
   struct dir_entry e;
+  block_sector_t parent;
+  block_sector_t sector;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   inode_lock_acquire(dir_get_inode((struct dir *) dir));
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  parent = inode_get_sector (dir->inode);
+  // cached lookup needs no directory data
+  if (dentry_lookup (parent, name, &sector))
+    *inode = sector != 0 ? inode_open (sector) : NULL;
+  else if (lookup (dir, name, &e, NULL, NULL))
+    {
+      dentry_insert (parent, name, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
   else
-    *inode = NULL;
+    {
+      dentry_insert (parent, name, 0);
+      *inode = NULL;
+    }
 
   inode_lock_release(dir_get_inode((struct dir *) dir));
   return *inode != NULL;
@@ -138,12 +337,13 @@ dir_lookup (const struct dir *dir, const char *name,
 
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
-   INODE_SECTOR.
+   INODE_SECTOR, and IS_DIR tells whether it is a directory.
    Returns true if successful, false on failure.
    Fails if NAME is invalid (i.e. too long) or a disk or memory
    error occurs. */
 bool
-dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+dir_add (struct dir *dir, const char *name, block_sector_t inode_sector,
+         bool is_dir)
 {
   struct dir_entry e;
   off_t ofs;
@@ -154,30 +354,46 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 
   inode_lock_acquire(dir_get_inode(dir));
   /* Check NAME for validity. */
-  if (*name == '\0' || strlen (name) > NAME_MAX)
-    return false;
+  if (*name == '\0' || strlen (name) > NAME_MAX
+      || !strcmp (name, ".") || !strcmp (name, ".."))
+    goto done;
 
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (dir, name, NULL, NULL, NULL))
     goto done;
 
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
-     current end-of-file.
-
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e)
-    if (!e.in_use)
-      break;
+     end of the entries used so far. */
+  ofs = dir_read_ofs (dir, offsetof (struct dir_header, free_ofs));
+  if (ofs != 0)
+    {
+      if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+          || !dir_write_ofs (dir, offsetof (struct dir_header, free_ofs), e.next))
+        goto done;
+    }
+  else
+    {
+      ofs = dir_read_ofs (dir, offsetof (struct dir_header, end_ofs));
+      if (ofs < DIR_HEADER_SIZE)
+        ofs = DIR_HEADER_SIZE;
+      if (!dir_write_ofs (dir, offsetof (struct dir_header, end_ofs), ofs + sizeof e))
+        goto done;
+    }
 
-  /* Write slot. */
+  /* Write slot at the head of its chain. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  e.is_dir = is_dir;
+  e.hash = hash_string (name);
+  e.next = dir_read_ofs (dir, dir_bucket_ofs (e.hash));
+  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e
+            && dir_write_ofs (dir, dir_bucket_ofs (e.hash), ofs)
+            && dir_write_ofs (dir, offsetof (struct dir_header, entry_cnt),
+                              dir_read_ofs (dir, offsetof (struct dir_header, entry_cnt)) + 1);
+  if (success)
+    dentry_insert (inode_get_sector (dir->inode), name, inode_sector);
 
  done:
   inode_lock_release(dir_get_inode(dir));
@@ -194,13 +410,14 @@ dir_remove (struct dir *dir, const char *name)
   struct inode *inode = NULL;
   bool success = false;
   off_t ofs;
+  off_t link;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
   inode_lock_acquire(dir_get_inode(dir));
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (!lookup (dir, name, &e, &ofs, &link))
     goto done;
 
   /* Open inode. */
@@ -225,12 +442,19 @@ dir_remove (struct dir *dir, const char *name)
     dir_close(dir_);
   }
 
-  /* Erase directory entry. */
+  /* Erase directory entry, moving it from its chain to the free list. */
+  if (!dir_write_ofs (dir, link, e.next))
+    goto done;
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+  e.next = dir_read_ofs (dir, offsetof (struct dir_header, free_ofs));
+  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+      || !dir_write_ofs (dir, offsetof (struct dir_header, free_ofs), ofs)
+      || !dir_write_ofs (dir, offsetof (struct dir_header, entry_cnt),
+                         dir_read_ofs (dir, offsetof (struct dir_header, entry_cnt)) - 1))
     goto done;
 
   /* Remove inode. */
+  dentry_insert (inode_get_sector (dir->inode), name, 0);
   inode_remove (inode);
   success = true;
 
@@ -246,169 +470,143 @@ dir_remove (struct dir *dir, const char *name)
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
-  struct dir_entry e;
+  struct dir_info info;
+
+  if (dir_readdir_batch (dir, &info, 1) == 0)
+    return false;
+  strlcpy (name, info.name, NAME_MAX + 1);
+  return true;
+}
+
+/* Reads up to CNT of the next directory entries in DIR into
+   ENTRIES, several entries per inode_read_at() call.
+   Returns the number of entries read, 0 if the directory contains
+   no more entries. */
+size_t
+dir_readdir_batch (struct dir *dir, struct dir_info entries[], size_t cnt)
+{
+  struct dir_entry e[DIR_BATCH_CNT];
+  size_t n = 0;
+
   inode_lock_acquire(dir_get_inode(dir));
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+  if (dir->pos < DIR_HEADER_SIZE)
+    dir->pos = DIR_HEADER_SIZE;
+  while (n < cnt)
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      size_t want = cnt - n < DIR_BATCH_CNT ? cnt - n : DIR_BATCH_CNT;
+      size_t got = inode_read_at (dir->inode, e, want * sizeof *e, dir->pos) / sizeof *e;
+      size_t i;
+
+      if (got == 0)
+        break;
+      for (i = 0; i < got && n < cnt; i++)
         {
-          strlcpy (name, e.name, NAME_MAX + 1);
-          inode_lock_release(dir_get_inode(dir));
-          return true;
+          dir->pos += sizeof *e;
+          if (e[i].in_use)
+            {
+              entries[n].inode_sector = e[i].inode_sector;
+              entries[n].is_dir = e[i].is_dir;
+              strlcpy (entries[n].name, e[i].name, NAME_MAX + 1);
+              n++;
+            }
         }
     }
 
   inode_lock_release(dir_get_inode(dir));
-  return false;
+  return n;
 }
 
 
 /* returns true if dir is empty */
 bool dir_is_empty(struct dir *dir){
-  struct dir_entry e;
-  off_t ofs;
-
   ASSERT (dir != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e; ofs += sizeof e){
-    if (e.in_use){
-      return false;
-    }
-  }
-
-  return true;
+  return dir_read_ofs(dir, offsetof(struct dir_header, entry_cnt)) == 0;
 }
 
-//to parse file name
-void parse_dir_path(char *dir_path, char *argv[], int *argc){
-  char *ret_ptr;
-  char *next_ptr;
+/* copies next component of path at *srcp to part and advances *srcp
+  returns 1 on success, 0 at end of path, -1 if component is too long */
+static int get_next_part(char part[NAME_MAX + 1], const char **srcp){
+  const char *src = *srcp;
+  char *dst = part;
 
-  ret_ptr = strtok_r((char *)dir_path, "/", &next_ptr);
-
-  while(ret_ptr){
-    argv[(*argc)] = ret_ptr;
-    ret_ptr = strtok_r(NULL, "/", &next_ptr);
-    //argc number is one less than argc
-    (*argc)++;
-
-    //ARGV NULL CASE
-    if(ret_ptr == NULL){
-      argv[(*argc)] = ret_ptr;
-      argc++;
-      break;
+  while(*src == '/'){
+    src++;
+  }
+  if(*src == '\0'){
+    return 0;
+  }
+  while(*src != '/' && *src != '\0'){
+    if(dst == part + NAME_MAX){
+      return -1;
     }
+    *dst++ = *src++;
   }
+  *dst = '\0';
+  *srcp = src;
+  return 1;
 }
 
-
-/* get absolute path of given file name */
-struct dir *dir_absolute_path(const char *dir_path){
-  char temp_path[FILE_NAME_MAX_LENGTH];
-  char *argv[ARGS_MAX_LENGTH];
-  int argc=0;
-
-  strlcpy(temp_path, dir_path, FILE_NAME_MAX_LENGTH);
-
-  parse_dir_path(temp_path, argv, &argc);
-
-  struct dir *dir = dir_open_root();
-
+/* opens inode of name in dir, where "" and "." are dir itself */
+static struct inode *dir_step(struct dir *dir, const char *name){
   struct inode *inode;
-  int i;
-  for(i=0; i<argc-1; i++){
-    if(!strcmp(argv[argc-1], "..")){
-      inode = dir_get_inode(dir);
-      block_sector_t parent_sector = inode_get_parent_sector(inode);
-      dir_close(dir);
-      inode = inode_open(parent_sector);
-      dir = dir_open(inode);
-      continue;
-    }
-    if(!strcmp(argv[argc-1], ".")){
-      continue;
-    }
-
-    dir_lookup(dir, argv[i], &inode);
-    // if file name is in is in dir
-    if(inode){
-      // if inode is dir
-      if(inode_get_dir(inode)){
-        dir_close(dir);
-        dir = dir_open(inode);
-        continue;
-      }
-      // if inode is file
-      else{
-        inode_close(inode);
-        dir_close(dir);
-        return NULL;
-      }
-    }
-    else{
-      dir_close(dir);
-      return NULL;
-    }
+  if(name[0] == '\0' || !strcmp(name, ".")){
+    return inode_reopen(dir->inode);
   }
-
-  return dir;
+  if(!strcmp(name, "..")){
+    return inode_open(inode_get_parent_sector(dir->inode));
+  }
+  dir_lookup(dir, name, &inode);
+  return inode;
 }
 
-/* get relative path of given file name */
-struct dir *dir_relative_path(const char *dir_path){
-  char temp_path[FILE_NAME_MAX_LENGTH];
-  char *argv[ARGS_MAX_LENGTH];
-  int argc=0;
-
-  strlcpy(temp_path, dir_path, FILE_NAME_MAX_LENGTH);
-
-  parse_dir_path(temp_path, argv, &argc);
-
+/* resolves path in a single pass, from start, or from the root or
+  current directory if start is NULL.
+  returns the opened directory holding the last component and copies
+  the component to name, "" if path names the start directory itself.
+  if inodep is non-null, also opens the component's inode into *inodep,
+  NULL if it does not exist.
+  returns NULL if a directory on the way is missing or a component is
+  too long. */
+struct dir *dir_namei(struct dir *start, const char *path, char name[NAME_MAX + 1], struct inode **inodep){
+  char part[NAME_MAX + 1];
   struct dir *dir;
-  if(!thread_current()->dir){
+  int ret = 0;
+
+  if(inodep != NULL){
+    *inodep = NULL;
+  }
+  if(path[0] == '/' || (start == NULL && thread_current()->dir == NULL)){
     dir = dir_open_root();
   }
   else{
-    dir = dir_reopen(thread_current()->dir);
+    dir = dir_reopen(start != NULL ? start : thread_current()->dir);
   }
 
-  struct inode *inode;
-  int i;
-  for(i=0; i<argc-1; i++){
-    if(!strcmp(argv[argc-1], "..")){
-      inode = dir_get_inode(dir);
-      block_sector_t parent_sector = inode_get_parent_sector(inode);
+  name[0] = '\0';
+  while(dir != NULL && (ret = get_next_part(part, &path)) > 0){
+    // previous component is on the way, so it must be a directory
+    if(name[0] != '\0'){
+      struct inode *inode = dir_step(dir, name);
       dir_close(dir);
-      inode = inode_open(parent_sector);
-      dir = dir_open(inode);
-      continue;
-    }
-    if(!strcmp(argv[argc-1], ".")){
-      continue;
-    }
-
-    dir_lookup(dir, argv[i], &inode);
-    // if file name is in is in dir
-    if(inode){
-      // if inode is dir
-      if(inode_get_dir(inode)){
-        dir_close(dir);
-        dir = dir_open(inode);
-        continue;
-      }
-      // if inode is file
-      else{
+      if(inode == NULL || !inode_get_dir(inode)){
         inode_close(inode);
-        dir_close(dir);
         return NULL;
       }
+      dir = dir_open(inode);
     }
-    else{
-      dir_close(dir);
-      return NULL;
-    }
+    strlcpy(name, part, NAME_MAX + 1);
+  }
+  if(dir == NULL){
+    return NULL;
+  }
+  if(ret < 0){
+    dir_close(dir);
+    return NULL;
   }
 
+  if(inodep != NULL){
+    *inodep = dir_step(dir, name);
+  }
   return dir;
 }
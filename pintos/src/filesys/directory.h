@@ -11,12 +11,21 @@
    retained, but much longer full path names must be allowed. */
 #define NAME_MAX 14
 
-#define FILE_NAME_MAX_LENGTH 100
-#define ARGS_MAX_LENGTH 25
-
 
 struct inode;
 
+/* A directory entry as read by dir_readdir_batch(). */
+struct dir_info
+  {
+    block_sector_t inode_sector;        /* Sector number of header. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Directory entry cache. */
+void dentry_init(void);
+void dentry_purge(block_sector_t parent);
+
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt, block_sector_t parent);
 struct dir *dir_open (struct inode *);
@@ -27,14 +36,13 @@ struct inode *dir_get_inode (struct dir *);
 
 /* Reading and writing. */
 bool dir_lookup (const struct dir *, const char *name, struct inode **);
-bool dir_add (struct dir *, const char *name, block_sector_t);
+bool dir_add (struct dir *, const char *name, block_sector_t, bool is_dir);
 bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
+size_t dir_readdir_batch (struct dir *, struct dir_info entries[], size_t cnt);
 
 /* utils */
 bool dir_is_empty(struct dir *dir);
-void parse_dir_path(char *dir_path, char *argv[], int *argc);
-struct dir *dir_absolute_path(const char *dir_path);
-struct dir *dir_relative_path(const char *dir_path);
+struct dir *dir_namei(struct dir *start, const char *path, char name[NAME_MAX + 1], struct inode **inodep);
 
 #endif /* filesys/directory.h */
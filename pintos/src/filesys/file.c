@@ -114,6 +114,17 @@ file_write_at (struct file *file, const void *buffer, off_t size,
   return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Preallocates SIZE bytes of FILE starting at offset FILE_OFS,
+   as contiguously as possible and without writing them, growing
+   FILE if needed.  The bytes read as zeros until written.
+   Returns true if successful, false if the disk is full.
+   The file's current position is unaffected. */
+bool
+file_allocate (struct file *file, off_t file_ofs, off_t size)
+{
+  return inode_allocate (file->inode, file_ofs, size);
+}
+
 /* Prevents write operations on FILE's underlying inode
    until file_allow_write() is called or FILE is closed. */
 void
@@ -23,6 +23,7 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  dentry_init ();
   free_map_init ();
 
   if (format)
@@ -36,16 +37,10 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
-  //synch
-  struct list_elem *e;
-  for(e=list_begin(&cache); e!=list_end(&cache); e=list_next(e)){
-    struct cache_entry *c = list_entry(e, struct cache_entry, elem);
-    if(c->dirty){
-      block_write(fs_device, c->sector_index, &c->data);
-    }
-  }
-
+  //synch, inode lengths go to disk after the data and free map they cover
+  inode_sync ();
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -54,32 +49,25 @@ filesys_done (void)
    or if internal memory allocation fails. */
 bool
 filesys_create (const char *name, off_t initial_size)
+{
+  return filesys_create_at (NULL, name, initial_size);
+}
+
+/* Creates a file named NAME relative to directory START, or to the
+   current directory if START is null, with the given INITIAL_SIZE.
+   Returns true if successful, false otherwise. */
+bool
+filesys_create_at (struct dir *start, const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
-  struct dir *dir = NULL;
-  // absolute path
-  if(name[0] == '/'){
-    dir = dir_absolute_path(name);
-  }
-  // relative path
-  else{
-    dir = dir_relative_path(name);
-  }
-
-  // get name of file
-  char temp_path[FILE_NAME_MAX_LENGTH];
-  char *argv[ARGS_MAX_LENGTH];
-  int argc=0;
-  strlcpy(temp_path, name, FILE_NAME_MAX_LENGTH);
-  parse_dir_path(temp_path, argv, &argc);
-
-  struct inode *parent = dir_get_inode(dir);
-  block_sector_t parent_sector = inode_get_sector(parent);
+  char leaf[NAME_MAX + 1];
+  struct dir *dir = dir_namei (start, name, leaf, NULL);
+  block_sector_t parent_sector = dir != NULL ? inode_get_sector (dir_get_inode (dir)) : 0;
 
   bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
+                  && free_map_allocate_near (1, parent_sector, &inode_sector)
                   && inode_create (inode_sector, initial_size, false, parent_sector)
-                  && dir_add (dir, argv[argc-1], inode_sector));
+                  && dir_add (dir, leaf, inode_sector, false));
   if (!success && inode_sector != 0)
     free_map_release (inode_sector, 1);
   dir_close (dir);
@@ -95,48 +83,22 @@ filesys_create (const char *name, off_t initial_size)
 struct file *
 filesys_open (const char *name)
 {
-  struct dir *dir = NULL;
-  // absolute path
-  if(name[0] == '/'){
-    dir = dir_absolute_path(name);
-  }
-  // relative path
-  else{
-    dir = dir_relative_path(name);
-  }
-
-  // get name of file
-  char temp_path[FILE_NAME_MAX_LENGTH];
-  char *argv[ARGS_MAX_LENGTH];
-  int argc=0;
-  strlcpy(temp_path, name, FILE_NAME_MAX_LENGTH);
-  parse_dir_path(temp_path, argv, &argc);
-
-
-  struct inode *inode = NULL;
-  // if argc is 0, open root dir
-  if(argc == 0){
-    inode = inode_open(ROOT_DIR_SECTOR);
-    dir_close (dir);
-    return file_open (inode);
-  }
-  else{
-    if (dir != NULL){
-      // if opening current directory
-      if(!strcmp(argv[argc-1], ".")){
-        inode = dir_get_inode(dir);
-        return file_open(inode);
-      }
-      else{
-        dir_lookup (dir, argv[argc-1], &inode);
-      dir_close (dir);
-      return file_open (inode);
-      }
-    }
-    else{
-      return NULL;
-    }
-  }
+  return filesys_open_at (NULL, name);
+}
+
+/* Opens the file named NAME relative to directory START, or to the
+   current directory if START is null.
+   Returns the new file if successful or a null pointer
+   otherwise. */
+struct file *
+filesys_open_at (struct dir *start, const char *name)
+{
+  char leaf[NAME_MAX + 1];
+  struct inode *inode;
+  struct dir *dir = dir_namei (start, name, leaf, &inode);
+
+  dir_close (dir);
+  return file_open (inode);
 }
 
 /* Deletes the file named NAME.
@@ -146,34 +108,23 @@ filesys_open (const char *name)
 bool
 filesys_remove (const char *name)
 {
-  // remove root directory
-  if(!strcmp(name, "/")){
-    return false;
-  }
-
-  struct dir *dir = NULL;
-  // absolute path
-  if(name[0] == '/'){
-    dir = dir_absolute_path(name);
-  }
-  // relative path
-  else{
-    dir = dir_relative_path(name);
-  }
-
-  // get name of file
-  char temp_path[FILE_NAME_MAX_LENGTH];
-  char *argv[ARGS_MAX_LENGTH];
-  int argc=0;
-  strlcpy(temp_path, name, FILE_NAME_MAX_LENGTH);
-  parse_dir_path(temp_path, argv, &argc);
-
-  bool success = dir != NULL && dir_remove (dir, argv[argc-1]);
+  return filesys_remove_at (NULL, name);
+}
+
+/* Deletes the file named NAME relative to directory START, or to
+   the current directory if START is null.
+   Returns true if successful, false on failure. */
+bool
+filesys_remove_at (struct dir *start, const char *name)
+{
+  char leaf[NAME_MAX + 1];
+  struct dir *dir = dir_namei (start, name, leaf, NULL);
+  bool success = dir != NULL && dir_remove (dir, leaf);
   dir_close (dir);
 
   return success;
 }
-
+
 /* Formats the file system. */
 static void
 do_format (void)
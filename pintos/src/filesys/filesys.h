@@ -8,6 +8,8 @@
 #define FREE_MAP_SECTOR 0       /* Free map file inode sector. */
 #define ROOT_DIR_SECTOR 1       /* Root directory file inode sector. */
 
+struct dir;
+
 /* Block device that contains the file system. */
 struct block *fs_device;
 
@@ -16,5 +18,8 @@ void filesys_done (void);
 bool filesys_create (const char *name, off_t initial_size);
 struct file *filesys_open (const char *name);
 bool filesys_remove (const char *name);
+bool filesys_create_at (struct dir *, const char *name, off_t initial_size);
+struct file *filesys_open_at (struct dir *, const char *name);
+bool filesys_remove_at (struct dir *, const char *name);
 
 #endif /* filesys/filesys.h */
@@ -1,52 +1,263 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "threads/malloc.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
+
+/* Number of free map bits stored in one sector of the free map file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The disk is split into allocation groups of this many sectors,
+   each with its own next-fit cursor. */
+#define FREE_MAP_GROUP_SIZE 1024
+
+/* Number of sectors skipped after the first block of a new file,
+   so that the next file started in the same group leaves room
+   for this one to grow contiguously. */
+#define FREE_MAP_RESERVE 64
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct bitmap *free_map_dirty; /* Dirty sectors of free map file. */
+static struct lock free_map_lock;    /* Protects free_map and free_map_dirty. */
+static block_sector_t *group_cursor; /* Next-fit cursor of each group. */
+static size_t group_cnt;             /* Number of allocation groups. */
+
+/* Marks the sectors of the free map file holding the bits for
+   CNT sectors starting at SECTOR as dirty. */
+static void
+free_map_mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+  if (cnt == 0)
+    return;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
+  size_t i;
+
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), FREE_MAP_GROUP_SIZE);
+  group_cursor = calloc (group_cnt, sizeof *group_cursor);
+  if (group_cursor == NULL)
+    PANIC ("allocation group creation failed");
+  for (i = 0; i < group_cnt; i++)
+    group_cursor[i] = i * FREE_MAP_GROUP_SIZE;
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
 
+/* Returns the sector just past the end of allocation group G. */
+static block_sector_t
+group_end (size_t g)
+{
+  block_sector_t end = (g + 1) * FREE_MAP_GROUP_SIZE;
+  return end < bitmap_size (free_map) ? end : bitmap_size (free_map);
+}
+
+/* Finds CNT free sectors in allocation group G, next-fit from
+   the group's cursor, marks them allocated, and advances the
+   cursor RESERVE sectors past them.  Returns the first sector,
+   or BITMAP_ERROR if the group has no such run.
+   free_map_lock must be held. */
+static block_sector_t
+group_allocate (size_t g, size_t cnt, size_t reserve)
+{
+  block_sector_t start = g * FREE_MAP_GROUP_SIZE;
+  block_sector_t end = group_end (g);
+  block_sector_t sector;
+
+  if (cnt > end - start)
+    return BITMAP_ERROR;
+  sector = bitmap_scan (free_map, group_cursor[g], cnt, false);
+  if (sector == BITMAP_ERROR || sector + cnt > end)
+    sector = bitmap_scan (free_map, start, cnt, false);
+  if (sector == BITMAP_ERROR || sector + cnt > end)
+    return BITMAP_ERROR;
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  free_map_mark_dirty (sector, cnt);
+  group_cursor[g] = sector + cnt + reserve;
+  if (group_cursor[g] >= end)
+    group_cursor[g] = start;
+  return sector;
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (cnt, 0, sectorp);
+}
+
+/* Allocates CNT consecutive sectors from the free map, preferring
+   the first run at or after sector HINT within HINT's allocation
+   group, then the rest of that group, then the following groups
+   wrapping around to the start of the disk, and stores the first
+   into *SECTORP.
+   Returns true if successful, false if not enough consecutive
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t hint, block_sector_t *sectorp)
+{
+  block_sector_t sector = BITMAP_ERROR;
+  size_t g;
+
+  lock_acquire (&free_map_lock);
+  if (hint >= bitmap_size (free_map))
+    hint = 0;
+  g = hint / FREE_MAP_GROUP_SIZE;
+  sector = bitmap_scan (free_map, hint, cnt, false);
+  if (sector == BITMAP_ERROR || sector + cnt > group_end (g))
     {
-      bitmap_set_multiple (free_map, sector, cnt, false);
-      sector = BITMAP_ERROR;
+      /* Nothing after HINT in its group: try the rest of the group
+         next-fit, then the group holding the next free run. */
+      block_sector_t next = sector;
+      sector = group_allocate (g, cnt, 0);
+      if (sector == BITMAP_ERROR && next == BITMAP_ERROR)
+        next = bitmap_scan (free_map, 0, cnt, false);
+      if (sector == BITMAP_ERROR && next != BITMAP_ERROR)
+        sector = group_allocate (next / FREE_MAP_GROUP_SIZE, cnt, 0);
+      if (sector == BITMAP_ERROR && next != BITMAP_ERROR)
+        {
+          /* Run spans groups. */
+          bitmap_set_multiple (free_map, next, cnt, true);
+          free_map_mark_dirty (next, cnt);
+          sector = next;
+        }
     }
+  else
+    {
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      free_map_mark_dirty (sector, cnt);
+    }
+  lock_release (&free_map_lock);
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT consecutive sectors for the first blocks of a new
+   file whose inode is at sector NEAR, at the next-fit cursor of
+   NEAR's allocation group, and stores the first into *SECTORP.
+   The cursor is moved FREE_MAP_RESERVE sectors past the run, so
+   files started one after another in a group, or written
+   concurrently, each have room to grow contiguously.
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool
+free_map_allocate_start (size_t cnt, block_sector_t near, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  if (near >= bitmap_size (free_map))
+    near = 0;
+  sector = group_allocate (near / FREE_MAP_GROUP_SIZE, cnt, FREE_MAP_RESERVE);
+  lock_release (&free_map_lock);
+  if (sector != BITMAP_ERROR)
+    {
+      *sectorp = sector;
+      return true;
+    }
+  return free_map_allocate_near (cnt, near, sectorp);
+}
+
+/* Allocates CNT consecutive sectors in the allocation group with
+   the most free sectors and stores the first into *SECTORP.
+   Used for directory inodes, so that directories spread over the
+   disk and the files in each stay close to it.
+   Returns true if successful, false if not enough consecutive
+   sectors were available. */
+bool
+free_map_allocate_spread (size_t cnt, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+  size_t g, best = 0, best_free = 0;
+
+  lock_acquire (&free_map_lock);
+  for (g = 0; g < group_cnt; g++)
+    {
+      block_sector_t start = g * FREE_MAP_GROUP_SIZE;
+      size_t free_cnt = bitmap_count (free_map, start, group_end (g) - start,
+                                      false);
+      if (free_cnt > best_free)
+        {
+          best = g;
+          best_free = free_cnt;
+        }
+    }
+  sector = group_allocate (best, cnt, 0);
+  lock_release (&free_map_lock);
+  if (sector != BITMAP_ERROR)
+    {
+      *sectorp = sector;
+      return true;
+    }
+  return free_map_allocate_near (cnt, best * FREE_MAP_GROUP_SIZE, sectorp);
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_map_mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the dirty sectors of the free map to the free map file.
+   Called from the write-behind thread and when the file system
+   is shut down, so that a burst of allocations costs one write
+   per bitmap sector touched instead of one whole-bitmap write
+   per allocation.  Returns true if successful, false if some
+   sector could not be written; those stay dirty. */
+bool
+free_map_flush (void)
+{
+  bool success = true;
+  size_t i;
+
+  /* Write-behind may run before the free map is initialized. */
+  if (free_map_dirty == NULL)
+    return true;
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = bitmap_scan (free_map_dirty, 0, 1, true); i != BITMAP_ERROR;
+         i = bitmap_scan (free_map_dirty, i + 1, 1, true))
+      {
+        if (bitmap_write_part (free_map, free_map_file,
+                               i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+          bitmap_reset (free_map_dirty, i);
+        else
+          success = false;
+      }
+  lock_release (&free_map_lock);
+  return success;
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,13 +269,19 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+  if (!free_map_flush ())
+    printf ("free map: can't write free map\n");
+  lock_acquire (&free_map_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -80,6 +297,14 @@ free_map_create (void)
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+
+  /* The file is created sparse.  Allocate all of its blocks
+     first, so that every bit they set is in the bitmap before any
+     sector of it is written.  Blocks allocated while writing
+     would leave sectors already written stale. */
+  if (!file_allocate (free_map_file, 0, bitmap_file_size (free_map)))
+    PANIC ("can't allocate free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
 }
@@ -16,14 +16,16 @@ void
 fsutil_ls (char **argv UNUSED)
 {
   struct dir *dir;
-  char name[NAME_MAX + 1];
+  struct dir_info entries[16];
+  size_t cnt, i;
 
   printf ("Files in the root directory:\n");
   dir = dir_open_root ();
   if (dir == NULL)
     PANIC ("root dir open failed");
-  while (dir_readdir (dir, name))
-    printf ("%s\n", name);
+  while ((cnt = dir_readdir_batch (dir, entries, 16)) > 0)
+    for (i = 0; i < cnt; i++)
+      printf ("%s\n", entries[i].name);
   dir_close (dir);
   printf ("End of listing.\n");
 }
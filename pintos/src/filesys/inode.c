@@ -1,5 +1,6 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
@@ -8,16 +9,47 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "filesys/cache.h"
+#include "filesys/directory.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4558   /* inode mapping blocks by extents */
 
 #define MAX_DIRECT_BLOCK 12
 #define MAX_INDIRECT_BLOCK 128
 #define MAX_FILE_SIZE 8388608       /* 8*1024*1024 */
 
+#define INODE_EXTENT_CNT 36         /* number of extents in inode_disk */
+#define EXTENT_BLOCK_CNT 42         /* number of extents in extent_disk */
+
+/* flag of a block pointer or extent sector that is preallocated
+   but not yet written, so the block still reads as zeros */
+#define SECTOR_UNWRITTEN 0x80000000
+
+/* sector looked up in extent inode whose block map cannot be built,
+  so it is unknown whether the block is allocated */
+#define SECTOR_NOMAP ((block_sector_t) -2)
+
+#define READ_AHEAD_MIN 1            /* read ahead window after random read */
+#define READ_AHEAD_MAX 32           /* read ahead window limit of sequential read */
+
+#define INODE_CACHE_SIZE 32         /* number of closed inodes kept in memory */
+
+#define FILL_RUN_MAX 16             /* blocks allocated and zeroed at once by a write */
+
+/* Run of blocks contiguous both in file and on disk.
+   Used as extent of extent inode and as block map entry. */
+struct block_run
+  {
+    block_sector_t block;               /* First logical block. */
+    block_sector_t sector;              /* Sector of first block. */
+    block_sector_t cnt;                 /* Number of blocks. */
+  };
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   INODE_MAGIC inode maps blocks by direct and indirect pointers,
+   INODE_EXTENT_MAGIC inode maps blocks by extents. */
 struct inode_disk
   {
     off_t length;                       /* File size in bytes. */
@@ -30,9 +62,18 @@ struct inode_disk
     bool dir;                       /* indicate whether inode is dir or not */
     block_sector_t parent;          /* parent sector number of dir */
 
-    uint32_t unused[110];               /* Not used. */
+    uint32_t extent_cnt;                /* number of extents in total */
+    block_sector_t extent_next;         /* sector of first extent block, 0 if none */
+    struct block_run extents[INODE_EXTENT_CNT];   /* first extents */
   };
 
+/* Overflow block of extents, chained from inode_disk. */
+struct extent_disk{
+  uint32_t extent_cnt;                  /* number of extents in this block */
+  block_sector_t next;                  /* sector of next extent block, 0 if none */
+  struct block_run extents[EXTENT_BLOCK_CNT];
+};
+
 struct indirect_disk{
   block_sector_t block_ptr[MAX_INDIRECT_BLOCK];
 };
@@ -42,14 +83,41 @@ struct double_indirect_disk{
 };
 
 /* for inode allocation and freeing */
-bool inode_alloc(struct inode_disk *disk_inode);
-bool inode_alloc_direct(struct inode_disk *disk_inode, block_sector_t sectors);
-bool inode_alloc_indirect(struct inode_disk *disk_inode, block_sector_t sectors);
-bool inode_alloc_double_indirect(struct inode_disk *disk_inode, block_sector_t sectors);
+static bool inode_alloc_block(block_sector_t sector, block_sector_t *hint, block_sector_t *blockp);
+static bool inode_alloc_index(struct inode *inode, block_sector_t *slot, block_sector_t *hint);
+static bool inode_set_pointer(struct inode *inode, block_sector_t block, block_sector_t value, block_sector_t *hint);
+static block_sector_t inode_alloc_pointer(struct inode *inode, block_sector_t block);
+static block_sector_t inode_prealloc_pointer(struct inode *inode, block_sector_t block, size_t *cnt);
+static block_sector_t inode_mark_written(struct inode *inode, block_sector_t block, size_t *cnt);
 void inode_free(struct inode *inode);
 
-/* for inode growth */
-void inode_grow(struct inode *inode, off_t size);
+/* for sparse files */
+static block_sector_t inode_lookup(struct inode *inode, block_sector_t block);
+static block_sector_t inode_walk(const struct inode *inode, block_sector_t block);
+static block_sector_t inode_fill_hole(struct inode *inode, block_sector_t block, size_t cnt);
+
+/* for extent inode */
+static bool inode_extents_read(struct inode *inode);
+static bool inode_extents_write(struct inode *inode);
+static block_sector_t inode_alloc_extent(struct inode *inode, block_sector_t block, size_t *cnt, bool unwritten);
+static void inode_free_extents(struct inode *inode);
+
+/* for read ahead */
+static void inode_read_ahead(struct inode *inode, off_t offset, off_t size);
+
+/* for in-memory block map */
+static bool inode_map_build(struct inode *inode);
+static bool inode_map_reserve(struct inode *inode, size_t cnt);
+static bool inode_map_append(struct inode *inode, block_sector_t block, block_sector_t sector, block_sector_t cnt);
+static bool inode_map_insert(struct inode *inode, block_sector_t block, block_sector_t sector, block_sector_t cnt);
+static bool inode_map_remap(struct inode *inode, block_sector_t block, block_sector_t cnt, block_sector_t sector);
+static void inode_map_drop(struct inode *inode);
+static void inode_map_reload(struct inode *inode);
+static size_t inode_map_next(const struct inode *inode, block_sector_t block);
+static block_sector_t inode_map_lookup(const struct inode *inode, block_sector_t block);
+
+/* format of inodes created, selected at boot with -extents */
+bool inode_use_extents;
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -62,75 +130,352 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open inode table. */
+    struct list_elem lru_elem;          /* Element in closed_inodes while closed. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    struct inode_disk data;
+    struct inode_disk data;             /* Inode content, length as on disk. */
 
-    size_t direct_cnt;                  /* number of direct block */
-    size_t indirect_cnt;                /* number of indirect direct block */
-    size_t double_indirect_cnt;         /* number of double indirect direct block */
+    off_t length;                       /* File size in bytes. */
+    off_t written_length;               /* length whose data is in the cache */
+    off_t flush_length;                 /* written_length before last cache flush */
+    bool dirty;                         /* true if length is not on disk yet */
+    struct list_elem dirty_elem;        /* element in dirty_inodes */
 
     bool dir;                           /* indicate whether inode is dir or not */
     block_sector_t parent;              /* parent sector number of dir */
+    bool extent;                        /* true if blocks are mapped by extents */
 
     struct lock inode_lock;              /* lock of inode */
+
+    off_t ra_next;                      /* offset of next read if sequential */
+    off_t ra_end;                       /* end of blocks already read ahead */
+    size_t ra_window;                   /* number of blocks to read ahead */
+
+    bool map_built;                     /* true if block map is built, always for extent inode */
+    struct block_run *map;              /* block map sorted by block */
+    size_t map_cnt;                     /* number of runs in map */
+    size_t map_cap;                     /* number of runs map can hold */
+    struct lock map_lock;               /* lock of block map */
   };
 
 /* Returns the block device sector that contains byte offset POS
    within INODE.
+   Returns 0 if POS lies in a hole, which reads as zeros and has
+   no sector until it is first written, and the sector with
+   SECTOR_UNWRITTEN set if POS lies in a preallocated block that
+   also reads as zeros.
+   Returns SECTOR_NOMAP if INODE uses extents and its block map
+   cannot be built.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
 
+  if (pos < inode->length){
+    lock_acquire(&inode->map_lock);
+    block_sector_t sector = inode_lookup(inode, pos / BLOCK_SECTOR_SIZE);
+    lock_release(&inode->map_lock);
+    return sector;
+  }
+  else
+    return -1;
+}
+
+/* returns sector of logical block of inode, 0 if it is a hole
+  looks up block map, built on first use, so holes cost no I/O
+  returns SECTOR_NOMAP if inode uses extents and its map cannot be built,
+  which is never a hole, map_lock must be held */
+static block_sector_t inode_lookup(struct inode *inode, block_sector_t block){
+  if(inode->map_built || inode_map_build(inode)){
+    block_sector_t sector = inode_map_lookup(inode, block);
+    return sector != (block_sector_t) -1 ? sector : 0;
+  }
+  // no map (out of memory) -> walk block pointers
+  return inode->extent ? SECTOR_NOMAP : inode_walk(inode, block);
+}
+
+/* walk block pointers of inode for sector of logical block
+  returns 0 for a hole, index blocks below a zero pointer are not read */
+static block_sector_t inode_walk(const struct inode *inode, block_sector_t block){
+  block_sector_t block_ptr[MAX_INDIRECT_BLOCK];
+  //direct
+  if(block < MAX_DIRECT_BLOCK){
+    return inode->data.direct_ptr[block];
+  }
+  //indirect
+  block -= MAX_DIRECT_BLOCK;
+  if(block < MAX_INDIRECT_BLOCK){
+    if(inode->data.indirect_ptr == 0){
+      return 0;
+    }
+    cache_read_meta(inode->data.indirect_ptr, block_ptr);
+    return block_ptr[block];
+  }
+  //double indirect
+  block -= MAX_INDIRECT_BLOCK;
+  if(block >= MAX_INDIRECT_BLOCK * MAX_INDIRECT_BLOCK || inode->data.double_indirect_ptr == 0){
+    return 0;
+  }
+  cache_read_meta(inode->data.double_indirect_ptr, block_ptr);
+  if(block_ptr[block / MAX_INDIRECT_BLOCK] == 0){
+    return 0;
+  }
+  cache_read_meta(block_ptr[block / MAX_INDIRECT_BLOCK], block_ptr);
+  return block_ptr[block % MAX_INDIRECT_BLOCK];
+}
+
+/* build block map of all allocated blocks of inode, holes are left out
+  map_lock must be held, returns false if out of memory */
+static bool inode_map_build(struct inode *inode){
   block_sector_t block_ptr[MAX_INDIRECT_BLOCK];     // for indirect case
   block_sector_t indirect_ptr[MAX_INDIRECT_BLOCK];  // for double indirect case
+  block_sector_t block = 0;
+  size_t i, j;
+
+  inode->map_cnt = 0;
+  // extent inode keeps its map on disk
+  if(inode->extent){
+    if(!inode_extents_read(inode)){
+      goto fail;
+    }
+    inode->map_built = true;
+    return true;
+  }
+  // direct
+  for(i=0; i<MAX_DIRECT_BLOCK; i++, block++){
+    if(inode->data.direct_ptr[i] != 0
+       && !inode_map_append(inode, block, inode->data.direct_ptr[i], 1)){
+      goto fail;
+    }
+  }
+  // indirect
+  if(inode->data.indirect_ptr != 0){
+    cache_read_meta(inode->data.indirect_ptr, block_ptr);
+    for(i=0; i<MAX_INDIRECT_BLOCK; i++){
+      if(block_ptr[i] != 0 && !inode_map_append(inode, block + i, block_ptr[i], 1)){
+        goto fail;
+      }
+    }
+  }
+  block += MAX_INDIRECT_BLOCK;
+  // double indirect, read each indirect block once
+  if(inode->data.double_indirect_ptr != 0){
+    cache_read_meta(inode->data.double_indirect_ptr, indirect_ptr);
+    for(j=0; j<MAX_INDIRECT_BLOCK; j++, block += MAX_INDIRECT_BLOCK){
+      if(indirect_ptr[j] == 0){
+        continue;
+      }
+      cache_read_meta(indirect_ptr[j], block_ptr);
+      for(i=0; i<MAX_INDIRECT_BLOCK; i++){
+        if(block_ptr[i] != 0 && !inode_map_append(inode, block + i, block_ptr[i], 1)){
+          goto fail;
+        }
+      }
+    }
+  }
+  inode->map_built = true;
+  return true;
+
+ fail:
+  inode_map_drop(inode);
+  return false;
+}
+
+/* make room for cnt more runs in block map
+  returns false if out of memory */
+static bool inode_map_reserve(struct inode *inode, size_t cnt){
+  if(inode->map_cnt + cnt > inode->map_cap){
+    size_t cap = inode->map_cap == 0 ? 4 : inode->map_cap * 2;
+    while(cap < inode->map_cnt + cnt){
+      cap *= 2;
+    }
+    struct block_run *map = realloc(inode->map, cap * sizeof *map);
+    if(map == NULL){
+      return false;
+    }
+    inode->map = map;
+    inode->map_cap = cap;
+  }
+  return true;
+}
 
-  if (pos < inode->data.length){
-    block_sector_t sectors = pos / BLOCK_SECTOR_SIZE;
-    //direct
-    if(sectors < MAX_DIRECT_BLOCK){
-      return inode->data.direct_ptr[sectors];
+/* append cnt blocks from block at sector to the end of block map
+  extends the last run if contiguous, returns false if out of memory */
+static bool inode_map_append(struct inode *inode, block_sector_t block, block_sector_t sector, block_sector_t cnt){
+  if(inode->map_cnt > 0){
+    struct block_run *last = &inode->map[inode->map_cnt - 1];
+    if(last->block + last->cnt == block && last->sector + last->cnt == sector){
+      last->cnt += cnt;
+      return true;
     }
-    //indirect
-    else if(sectors < (MAX_DIRECT_BLOCK + MAX_INDIRECT_BLOCK)){
-      int diff = sectors - MAX_DIRECT_BLOCK;  // get offset at indirect
-      block_read(fs_device, inode->data.indirect_ptr, &block_ptr);  // get indirect
-      return block_ptr[diff];
+  }
+  if(!inode_map_reserve(inode, 1)){
+    return false;
+  }
+  struct block_run *run = &inode->map[inode->map_cnt++];
+  run->block = block;
+  run->sector = sector;
+  run->cnt = cnt;
+  return true;
+}
+
+/* insert cnt blocks from block at sector into block map, which may be
+  in a hole between runs, merging with neighbours if contiguous
+  map_lock must be held, returns false if out of memory */
+static bool inode_map_insert(struct inode *inode, block_sector_t block, block_sector_t sector, block_sector_t cnt){
+  size_t i = inode_map_next(inode, block);
+  if(i == inode->map_cnt){
+    return inode_map_append(inode, block, sector, cnt);
+  }
+  struct block_run *next = &inode->map[i];
+  bool join_next = block + cnt == next->block && sector + cnt == next->sector;
+  if(i > 0){
+    struct block_run *prev = &inode->map[i - 1];
+    if(prev->block + prev->cnt == block && prev->sector + prev->cnt == sector){
+      prev->cnt += cnt;
+      // run filled the gap between prev and next
+      if(join_next){
+        prev->cnt += next->cnt;
+        memmove(next, next + 1, (inode->map_cnt - i - 1) * sizeof *next);
+        inode->map_cnt--;
+      }
+      return true;
+    }
+  }
+  if(join_next){
+    next->block = block;
+    next->sector = sector;
+    next->cnt += cnt;
+    return true;
+  }
+  if(!inode_map_reserve(inode, 1)){
+    return false;
+  }
+  next = &inode->map[i];
+  memmove(next + 1, next, (inode->map_cnt - i) * sizeof *next);
+  next->block = block;
+  next->sector = sector;
+  next->cnt = cnt;
+  inode->map_cnt++;
+  return true;
+}
+
+/* map cnt blocks from block, which lie in one run, to sector instead
+  splitting the run around them, map_lock must be held
+  returns false if out of memory */
+static bool inode_map_remap(struct inode *inode, block_sector_t block, block_sector_t cnt, block_sector_t sector){
+  size_t i = inode_map_next(inode, block) - 1;
+  struct block_run run = inode->map[i];
+  block_sector_t head = block - run.block;
+  block_sector_t tail = run.cnt - head - cnt;
+
+  ASSERT(block >= run.block && head + cnt <= run.cnt);
+  // run is replaced by up to three runs
+  if(!inode_map_reserve(inode, 2)){
+    return false;
+  }
+  memmove(&inode->map[i], &inode->map[i + 1], (inode->map_cnt - i - 1) * sizeof *inode->map);
+  inode->map_cnt--;
+  if(head > 0){
+    inode_map_insert(inode, run.block, run.sector, head);
+  }
+  inode_map_insert(inode, block, sector, cnt);
+  if(tail > 0){
+    inode_map_insert(inode, block + cnt, run.sector + head + cnt, tail);
+  }
+  return true;
+}
+
+/* free block map, so it is rebuilt on next use */
+static void inode_map_drop(struct inode *inode){
+  free(inode->map);
+  inode->map = NULL;
+  inode->map_cnt = inode->map_cap = 0;
+  inode->map_built = false;
+}
+
+/* rebuild block map from the block pointers or extents on disk,
+  undoing changes to the map that did not reach them
+  map_lock must be held */
+static void inode_map_reload(struct inode *inode){
+  inode_map_drop(inode);
+  inode_map_build(inode);
+}
+
+/* returns index of first run of block map starting after block */
+static size_t inode_map_next(const struct inode *inode, block_sector_t block){
+  size_t lo = 0, hi = inode->map_cnt;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    if(inode->map[mid].block > block){
+      hi = mid;
     }
-    //double indirect
     else{
-      int diff = sectors - (MAX_INDIRECT_BLOCK + MAX_DIRECT_BLOCK); // get offset at double indirect
-      block_read(fs_device, inode->data.double_indirect_ptr, &indirect_ptr);   // get indirect
-      int indirect_idx = diff / MAX_INDIRECT_BLOCK; // get index of indirect at double indirect
-      block_read(fs_device, indirect_ptr[indirect_idx], &block_ptr);  //get indirect
-      int block_idx = diff % MAX_INDIRECT_BLOCK;  // get offset in indirect
-      return block_ptr[block_idx];
+      lo = mid + 1;
     }
   }
-  else
-    return -1;
+  return lo;
+}
+
+/* binary search block map for sector of block
+  returns -1 if block is not mapped */
+static block_sector_t inode_map_lookup(const struct inode *inode, block_sector_t block){
+  size_t lo = 0, hi = inode->map_cnt;
+  while(lo < hi){
+    size_t mid = (lo + hi) / 2;
+    const struct block_run *run = &inode->map[mid];
+    if(block < run->block){
+      hi = mid;
+    }
+    else if(block >= run->block + run->cnt){
+      lo = mid + 1;
+    }
+    else{
+      return run->sector + (block - run->block);
+    }
+  }
+  return -1;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Open inodes indexed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Closed inodes kept in open_inodes, so that reopening one needs
+   no I/O, most recently closed first. */
+static struct list closed_inodes;
+static size_t closed_cnt;
+
+/* Inodes whose length is larger than on disk, and lock for them. */
+static struct list dirty_inodes;
+static struct lock dirty_lock;
+
+static void inode_mark_dirty(struct inode *inode, off_t length);
+static void inode_evict(struct inode *inode);
+static void inode_trim(void);
+static unsigned inode_hash(const struct hash_elem *e, void *aux);
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b, void *aux);
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  list_init (&dirty_inodes);
+  lock_init (&dirty_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data starts out as one hole, so no data block is
+   allocated or written until it is first written.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
@@ -149,148 +494,225 @@ inode_create (block_sector_t sector, off_t length, bool dir, block_sector_t pare
   if (disk_inode != NULL)
     {
       disk_inode->length = length;
-      if (disk_inode->length > MAX_FILE_SIZE){
+      disk_inode->magic = inode_use_extents ? INODE_EXTENT_MAGIC : INODE_MAGIC;
+      if (!inode_use_extents && disk_inode->length > MAX_FILE_SIZE){
         disk_inode->length = MAX_FILE_SIZE;
       }
-      disk_inode->magic = INODE_MAGIC;
       disk_inode->dir = dir;
       disk_inode->parent = parent;
-      // allocate disk_inode
-      if (inode_alloc(disk_inode))
-        {
-          block_write (fs_device, sector, disk_inode);
-          success = true;
-        }
+      cache_write_meta(sector, disk_inode);
+      success = true;
       free (disk_inode);
     }
   return success;
 }
 
+/* allocate one block for inode at sector, *hint is the sector after
+  the last block allocated for it, or 0 if it has none yet
+  first block starts a new run in the allocation group of inode,
+  later ones go right after the previous one if possible */
+static bool inode_alloc_block(block_sector_t sector, block_sector_t *hint, block_sector_t *blockp){
+  bool success;
+  if(*hint == 0){
+    success = free_map_allocate_start(1, sector, blockp);
+  }
+  else{
+    success = free_map_allocate_near(1, *hint, blockp);
+  }
+  if(success){
+    *hint = *blockp + 1;
+  }
+  return success;
+}
 
-/* allocate inode disk in filesys disk */
-bool inode_alloc(struct inode_disk *disk_inode){
-  size_t sectors = bytes_to_sectors (disk_inode->length);
-  // direct alloc
-  if(sectors <= MAX_DIRECT_BLOCK){
-    if(!inode_alloc_direct(disk_inode, sectors)){
-        return false;
-    }
+/* allocate zeroed index block for *slot if it is a hole */
+static bool inode_alloc_index(struct inode *inode, block_sector_t *slot, block_sector_t *hint){
+  static char zeros[BLOCK_SECTOR_SIZE];
+  if(*slot != 0){
+    return true;
   }
-  // indirect alloc
-  else if((MAX_DIRECT_BLOCK < sectors) && (sectors <= (MAX_DIRECT_BLOCK + MAX_INDIRECT_BLOCK))){
-    // do direct alloc first
-    if(!inode_alloc_direct(disk_inode, MAX_DIRECT_BLOCK)){
-      return false;
-    }
-    // do indirect alloc
-    sectors -= MAX_DIRECT_BLOCK;
-    if(!inode_alloc_indirect(disk_inode, sectors + 1)){
+  if(!inode_alloc_block(inode->sector, hint, slot)){
+    return false;
+  }
+  cache_write_meta(*slot, zeros);
+  return true;
+}
+
+/* store value as pointer of logical block of pointer inode, allocating
+  index blocks it needs near *hint, map_lock must be held
+  caller writes the inode sector
+  returns false if disk is full or block is too far */
+static bool inode_set_pointer(struct inode *inode, block_sector_t block, block_sector_t value, block_sector_t *hint){
+  block_sector_t block_ptr[MAX_INDIRECT_BLOCK];
+  block_sector_t indirect;
+  //direct
+  if(block < MAX_DIRECT_BLOCK){
+    inode->data.direct_ptr[block] = value;
+    return true;
+  }
+  //indirect
+  block -= MAX_DIRECT_BLOCK;
+  if(block < MAX_INDIRECT_BLOCK){
+    if(!inode_alloc_index(inode, &inode->data.indirect_ptr, hint)){
       return false;
     }
+    indirect = inode->data.indirect_ptr;
   }
-  // double indirect alloc
+  //double indirect
   else{
-    // do direct alloc first
-    if(!inode_alloc_direct(disk_inode, MAX_DIRECT_BLOCK)){
-      return false;
-    }
-    // do indirect alloc
-    sectors -= MAX_DIRECT_BLOCK;
-    if(!inode_alloc_indirect(disk_inode, MAX_INDIRECT_BLOCK)){
+    block -= MAX_INDIRECT_BLOCK;
+    if(block >= MAX_INDIRECT_BLOCK * MAX_INDIRECT_BLOCK
+       || !inode_alloc_index(inode, &inode->data.double_indirect_ptr, hint)){
       return false;
     }
-    // do double indirect alloc
-    sectors -= MAX_INDIRECT_BLOCK;
-    if(!inode_alloc_double_indirect(disk_inode, sectors)){
-      return false;
+    cache_read_meta(inode->data.double_indirect_ptr, block_ptr);
+    if(block_ptr[block / MAX_INDIRECT_BLOCK] == 0){
+      if(!inode_alloc_index(inode, &block_ptr[block / MAX_INDIRECT_BLOCK], hint)){
+        return false;
+      }
+      cache_write_meta(inode->data.double_indirect_ptr, block_ptr);
     }
+    indirect = block_ptr[block / MAX_INDIRECT_BLOCK];
+    block %= MAX_INDIRECT_BLOCK;
   }
+  cache_read_meta(indirect, block_ptr);
+  block_ptr[block] = value;
+  cache_write_meta(indirect, block_ptr);
   return true;
 }
 
-/* direct alloc */
-bool inode_alloc_direct(struct inode_disk *disk_inode, block_sector_t sectors){
-  static char zeros[BLOCK_SECTOR_SIZE];
-  unsigned i;
-  for(i=0; i<sectors; i++){
-    if(!free_map_allocate(1, &disk_inode->direct_ptr[i])){
-      return false;
+/* allocate data block for the hole at logical block of pointer inode,
+  with any index blocks it needs, and add it to block map
+  map_lock must be held, caller writes the inode sector
+  returns the new sector, or 0 if disk is full or block is too far */
+static block_sector_t inode_alloc_pointer(struct inode *inode, block_sector_t block){
+  block_sector_t sector;
+  // place block right after previous one
+  block_sector_t hint = block > 0 ? inode_lookup(inode, block - 1) & ~SECTOR_UNWRITTEN : 0;
+  if(hint != 0){
+    hint++;
+  }
+  if(!inode_alloc_block(inode->sector, &hint, &sector)){
+    return 0;
+  }
+  if(!inode_set_pointer(inode, block, sector, &hint)){
+    free_map_release(sector, 1);
+    return 0;
+  }
+  // if out of memory, drop the map so it is rebuilt later
+  if(inode->map_built && !inode_map_insert(inode, block, sector, 1)){
+    inode_map_drop(inode);
+  }
+  return sector;
+}
+
+/* preallocate a contiguous run of up to *cnt blocks, marked unwritten,
+  for the hole at logical block of pointer inode, halving the run if
+  disk is fragmented, map_lock must be held, caller writes inode sector
+  sets *cnt to the run length, returns its first sector or 0 if disk is full */
+static block_sector_t inode_prealloc_pointer(struct inode *inode, block_sector_t block, size_t *cnt){
+  block_sector_t sector;
+  size_t i;
+  block_sector_t hint = block > 0 ? inode_lookup(inode, block - 1) & ~SECTOR_UNWRITTEN : 0;
+  if(hint != 0){
+    hint++;
+  }
+  while(!(hint == 0 ? free_map_allocate_start(*cnt, inode->sector, &sector)
+                    : free_map_allocate_near(*cnt, hint, &sector))){
+    if(*cnt == 1){
+      return 0;
     }
-    block_write(fs_device, disk_inode->direct_ptr[i], zeros);
+    *cnt /= 2;
   }
-  return true;
+  // index blocks go after the run
+  hint = sector + *cnt;
+  for(i=0; i<*cnt; i++){
+    if(!inode_set_pointer(inode, block + i, (sector + i) | SECTOR_UNWRITTEN, &hint)){
+      free_map_release(sector + i, *cnt - i);
+      *cnt = i;
+      break;
+    }
+  }
+  if(*cnt == 0){
+    return 0;
+  }
+  if(inode->map_built && !inode_map_insert(inode, block, sector | SECTOR_UNWRITTEN, *cnt)){
+    inode_map_drop(inode);
+  }
+  return sector;
 }
 
-/* indirect alloc */
-bool inode_alloc_indirect(struct inode_disk *disk_inode, block_sector_t sectors){
-  static char zeros[BLOCK_SECTOR_SIZE];
-  struct indirect_disk *id = malloc(sizeof(struct indirect_disk)); // make indirect block
-  // allocate along indirect block
-  unsigned i;
-  for(i=0; i<sectors; i++){
-    if(!free_map_allocate(1, &id->block_ptr[i])){
-      return false;
+/* clear unwritten flag of blocks from logical block before their first
+  write, up to *cnt blocks of the same extent, one block of pointer inode
+  map_lock must be held, caller writes the inode sector
+  sets *cnt to the number of blocks, returns sector of block or 0 if out of memory */
+static block_sector_t inode_mark_written(struct inode *inode, block_sector_t block, size_t *cnt){
+  block_sector_t sector = inode_lookup(inode, block) & ~SECTOR_UNWRITTEN;
+  if(!inode->extent){
+    // index blocks exist already, so this cannot fail
+    block_sector_t hint = 0;
+    *cnt = 1;
+    inode_set_pointer(inode, block, sector, &hint);
+    if(inode->map_built && !inode_map_remap(inode, block, 1, sector)){
+      inode_map_drop(inode);
     }
-    block_write(fs_device, id->block_ptr[i], zeros);
+    return sector;
   }
-  if(!free_map_allocate(1, &disk_inode->indirect_ptr)){  // alloc blocks for indirect
-    return false;
+  const struct block_run *run = &inode->map[inode_map_next(inode, block) - 1];
+  if(run->block + run->cnt - block < *cnt){
+    *cnt = run->block + run->cnt - block;
   }
-  block_write(fs_device, disk_inode->indirect_ptr, id); // write indirect block
-  free(id);
-  return true;
+  if(!inode_map_remap(inode, block, *cnt, sector)){
+    return 0;
+  }
+  // blocks stay unwritten on disk -> so must they in the map
+  if(!inode_extents_write(inode)){
+    inode_map_reload(inode);
+    return 0;
+  }
+  return sector;
 }
 
-/* double indirect alloc */
-bool inode_alloc_double_indirect(struct inode_disk *disk_inode, block_sector_t sectors){
-  static char zeros[BLOCK_SECTOR_SIZE];
-  block_sector_t indirect_cnt = (sectors / MAX_INDIRECT_BLOCK) + 1;
-  struct double_indirect_disk *did = malloc(sizeof(struct double_indirect_disk));  // make double indirect block
-  // iterate through indirect_cnt
-  unsigned i;
-  for(i=0; i<indirect_cnt; i++){
-    // if sector is less then indirect block
-    if(sectors < MAX_INDIRECT_BLOCK){
-      struct indirect_disk *id = malloc(sizeof(struct indirect_disk)); // make indirect block
-      unsigned j;
-      for(j=0; j<sectors; j++){
-        if(!free_map_allocate(1, &id->block_ptr[j])){
-          return false;
-        }
-        block_write(fs_device, id->block_ptr[j], zeros);
-      }
-      if(!free_map_allocate(1, &did->indirect_ptr[i])){  // alloc blocks for indirect in double indirect block
-        return false;
-      }
-      block_write(fs_device, did->indirect_ptr[i], id); // write indirect block
-      free(id);
+/* allocate the hole at logical block of inode on its first write, or
+  mark it written if it is preallocated
+  extent inode gets a run of up to cnt blocks, pointer inode one block
+  sectors of the new blocks hold stale data, so their cache entries are
+  zeroed before map_lock is released and any reader can map them
+  returns sector of block, or 0 if disk is full or the block map of
+  extent inode cannot be built */
+static block_sector_t inode_fill_hole(struct inode *inode, block_sector_t block, size_t cnt){
+  size_t i;
+
+  if(cnt > FILL_RUN_MAX){
+    cnt = FILL_RUN_MAX;
+  }
+  lock_acquire(&inode->map_lock);
+  block_sector_t sector = inode_lookup(inode, block);
+  if(sector == SECTOR_NOMAP){
+    sector = 0;
+  }
+  else if(sector == 0 || (sector & SECTOR_UNWRITTEN)){
+    if(sector != 0){
+      sector = inode_mark_written(inode, block, &cnt);
+    }
+    else if(inode->extent){
+      sector = inode_alloc_extent(inode, block, &cnt, false);
     }
     else{
-      struct indirect_disk *id = malloc(sizeof(struct indirect_disk)); // make indirect block
-      // allocate along indirect block
-      unsigned j;
-      for(j=0; j<MAX_INDIRECT_BLOCK; j++){
-        if(!free_map_allocate(1, &id->block_ptr[j])){
-          return false;
-        }
-        block_write(fs_device, id->block_ptr[j], zeros);
-      }
-      if(!free_map_allocate(1, &did->indirect_ptr[i])){  // alloc blocks for indirect in double indirect block
-        return false;
-      }
-      block_write(fs_device, did->indirect_ptr[i], id); // write indirect block
-      free(id);
+      sector = inode_alloc_pointer(inode, block);
+      cnt = 1;
     }
-    sectors -= MAX_INDIRECT_BLOCK;
-  }
-
-  if(!free_map_allocate(1, &disk_inode->double_indirect_ptr)){  // alloc blocks for double indirect
-    return false;
+    for(i=0; sector != 0 && i<cnt; i++){
+      struct cache_entry *c = cache_acquire_overwrite(sector + i);
+      c->meta = false;
+      memset(c->data, 0, BLOCK_SECTOR_SIZE);
+      cache_release(c, true);
+    }
+    // a failed allocation may still have linked an extent block
+    cache_write_meta(inode->sector, &inode->data);
   }
-  block_write(fs_device, disk_inode->double_indirect_ptr, did); // write double indirect block
-  free(did);
-
-  return true;
+  lock_release(&inode->map_lock);
+  return sector;
 }
 
 /* Reads an inode from SECTOR
@@ -299,19 +721,24 @@ bool inode_alloc_double_indirect(struct inode_disk *disk_inode, block_sector_t s
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
+      inode = hash_entry (e, struct inode, elem);
+      // closed inode kept in memory, revive it
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode;
+          list_remove (&inode->lru_elem);
+          closed_cnt--;
         }
+      inode_reopen (inode);
+      return inode;
     }
 
   /* Allocate memory. */
@@ -320,42 +747,57 @@ inode_open (block_sector_t sector)
     return NULL;
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
+  hash_insert (&open_inodes, &inode->elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
-  // init counts
-  size_t sectors = bytes_to_sectors(inode->data.length);
-  // direct case
-  if(sectors <= MAX_DIRECT_BLOCK){
-    inode->direct_cnt = sectors;
-    inode->indirect_cnt = 0;
-    inode->double_indirect_cnt = 0;
-  }
-  // indirect case
-  else if(sectors <= MAX_DIRECT_BLOCK + MAX_INDIRECT_BLOCK){
-    inode->direct_cnt = MAX_DIRECT_BLOCK;
-    inode->indirect_cnt = (sectors - MAX_DIRECT_BLOCK);
-    inode->double_indirect_cnt = 0;
-  }
-  // double indirect case
-  else{
-    inode->direct_cnt = MAX_DIRECT_BLOCK;
-    inode->indirect_cnt = MAX_INDIRECT_BLOCK;
-    inode->double_indirect_cnt = (sectors - MAX_DIRECT_BLOCK - MAX_INDIRECT_BLOCK);
-  }
+  cache_read_meta(inode->sector, &inode->data);
+  inode->length = inode->data.length;
+  inode->written_length = inode->data.length;
+  inode->flush_length = inode->data.length;
+  inode->dirty = false;
 
   inode->dir = inode->data.dir;
   inode->parent = inode->data.parent;
+  inode->extent = inode->data.magic == INODE_EXTENT_MAGIC;
 
   lock_init(&inode->inode_lock);
 
+  inode->ra_next = 0;
+  inode->ra_end = 0;
+  inode->ra_window = READ_AHEAD_MIN;
+
+  inode->map_built = false;
+  inode->map = NULL;
+  inode->map_cnt = 0;
+  inode->map_cap = 0;
+  lock_init(&inode->map_lock);
+
+  // extent inode needs its map in memory
+  if(inode->extent && !inode_map_build(inode)){
+    hash_delete(&open_inodes, &inode->elem);
+    free(inode);
+    return NULL;
+  }
+
   return inode;
 }
 
 
+/* Returns a hash value for inode, by its sector. */
+static unsigned inode_hash(const struct hash_elem *e, void *aux UNUSED){
+  const struct inode *inode = hash_entry(e, struct inode, elem);
+  return hash_int(inode->sector);
+}
+
+/* Returns true if inode a precedes inode b. */
+static bool inode_less(const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct inode *a = hash_entry(a_, struct inode, elem);
+  const struct inode *b = hash_entry(b_, struct inode, elem);
+  return a->sector < b->sector;
+}
+
 /* Reopens and returns INODE. */
 struct inode *
 inode_reopen (struct inode *inode)
@@ -372,9 +814,12 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
-/* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+/* Closes INODE.
+   If this was the last reference to INODE, keeps it in memory
+   among the recently closed inodes, evicting the least recently
+   closed ones whose length is on disk while there are too many.  Its data needs no write,
+   since every change was written through the buffer cache.
+   If INODE was also a removed inode, frees its blocks and memory. */
 void
 inode_close (struct inode *inode)
 {
@@ -385,22 +830,114 @@ inode_close (struct inode *inode)
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
-
       /* Deallocate blocks if removed. */
       if (inode->removed)
         {
+          // unlink first, so inode_sync() never writes the dead inode
+          // to its freed sector
+          lock_acquire(&dirty_lock);
+          if(inode->dirty){
+            list_remove(&inode->dirty_elem);
+            inode->dirty = false;
+          }
+          lock_release(&dirty_lock);
+          // entries cached under it would be found in a later directory
+          // that reuses its sector
+          if(inode->dir){
+            dentry_purge(inode->sector);
+          }
           inode_free(inode);
+          inode_evict(inode);
         }
-      // save inode data to disk
+      // keep it for reopening
       else{
-        block_write(fs_device, inode->sector, &inode->data);
+        list_push_front(&closed_inodes, &inode->lru_elem);
+        closed_cnt++;
+        inode_trim();
       }
-      free (inode);
     }
 }
 
+/* evict least recently closed inodes whose length is on disk until at
+  most INODE_CACHE_SIZE are kept
+  dirty ones stay until inode_sync() cleans them, so the list may grow
+  past the bound between write-behind runs, and shrinks back here */
+static void inode_trim(void){
+  struct list_elem *e = list_rbegin(&closed_inodes);
+  while(closed_cnt > INODE_CACHE_SIZE && e != list_rend(&closed_inodes)){
+    struct inode *victim = list_entry(e, struct inode, lru_elem);
+    e = list_prev(e);
+    if(!victim->dirty){
+      list_remove(&victim->lru_elem);
+      closed_cnt--;
+      inode_evict(victim);
+    }
+  }
+}
+
+/* remove closed inode from open inode table and free its memory */
+static void inode_evict(struct inode *inode){
+  ASSERT(inode->open_cnt == 0);
+  ASSERT(!inode->dirty);
+  hash_delete(&open_inodes, &inode->elem);
+  free(inode->map);
+  free(inode);
+}
+
+/* record that data of inode up to length is in the cache
+  the length is written to disk lazily by inode_sync() */
+static void inode_mark_dirty(struct inode *inode, off_t length){
+  lock_acquire(&dirty_lock);
+  if(length > inode->written_length){
+    inode->written_length = length;
+  }
+  if(!inode->dirty && inode->written_length > inode->data.length){
+    inode->dirty = true;
+    inode->flush_length = inode->data.length;
+    list_push_back(&dirty_inodes, &inode->dirty_elem);
+  }
+  lock_release(&dirty_lock);
+}
+
+/* snapshot lengths of extended inodes, flush the free map and the
+  buffer cache, then put the snapshotted lengths into their cached
+  inode sectors
+  so a length reaches disk only after the data, block pointers and free
+  map bits it covers, and a crash never shows a length past what was
+  written or covering free blocks
+  the lengths themselves reach disk at the next cache flush */
+void inode_sync(void){
+  struct list_elem *e;
+
+  // lengths whose data is in the cache now
+  lock_acquire(&dirty_lock);
+  for(e = list_begin(&dirty_inodes); e != list_end(&dirty_inodes); e = list_next(e)){
+    struct inode *inode = list_entry(e, struct inode, dirty_elem);
+    inode->flush_length = inode->written_length;
+  }
+  lock_release(&dirty_lock);
+
+  // blocks allocated before the snapshot are marked in the free map
+  free_map_flush();
+  cache_flush();
+
+  // their data is on disk, so the lengths can follow
+  lock_acquire(&dirty_lock);
+  for(e = list_begin(&dirty_inodes); e != list_end(&dirty_inodes); ){
+    struct inode *inode = list_entry(e, struct inode, dirty_elem);
+    e = list_next(e);
+    if(inode->flush_length > inode->data.length){
+      inode->data.length = inode->flush_length;
+      cache_write_meta(inode->sector, &inode->data);
+    }
+    if(inode->data.length >= inode->written_length){
+      list_remove(&inode->dirty_elem);
+      inode->dirty = false;
+    }
+  }
+  lock_release(&dirty_lock);
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
@@ -411,43 +948,51 @@ inode_remove (struct inode *inode)
 }
 
 
-/* free inode disk */
+/* free inode disk, holes have nothing to free */
 void inode_free(struct inode *inode){
   block_sector_t block_ptr[MAX_INDIRECT_BLOCK];     // for indirect case
   block_sector_t indirect_ptr[MAX_INDIRECT_BLOCK];  // for double indirect case
   unsigned i, j;
 
-  // direct
-  for(i=0; i<inode->direct_cnt; i++){
-    free_map_release(inode->data.direct_ptr[i], 1);
-  }
-  // indirect
-  if(inode->data.indirect_ptr == 0){
+  // extent inode
+  if(inode->extent){
+    inode_free_extents(inode);
+    free_map_release(inode->sector, 1);
     return;
   }
-  block_read(fs_device, inode->data.indirect_ptr, block_ptr); // read indirect block ptr
-  for(i=0; i<inode->indirect_cnt; i++){
-    free_map_release(block_ptr[i], 1);
-  }
-  // dobule indirect
-  if(inode->data.double_indirect_ptr == 0){
-    return;
+
+  // direct
+  for(i=0; i<MAX_DIRECT_BLOCK; i++){
+    if(inode->data.direct_ptr[i] != 0){
+      free_map_release(inode->data.direct_ptr[i] & ~SECTOR_UNWRITTEN, 1);
+    }
   }
-  unsigned indirects = (inode->double_indirect_cnt / MAX_INDIRECT_BLOCK) + 1;
-  block_read(fs_device, inode->data.double_indirect_ptr, indirect_ptr);
-  for(i=0; i<indirects; i++){
-    block_read(fs_device, indirect_ptr[i], block_ptr);
-    if(inode->double_indirect_cnt < MAX_INDIRECT_BLOCK){
-      for(j=0; j<inode->double_indirect_cnt; j++){
-        free_map_release(block_ptr[i], 1);
+  // indirect
+  if(inode->data.indirect_ptr != 0){
+    cache_read_meta(inode->data.indirect_ptr, block_ptr); // read indirect block ptr
+    for(i=0; i<MAX_INDIRECT_BLOCK; i++){
+      if(block_ptr[i] != 0){
+        free_map_release(block_ptr[i] & ~SECTOR_UNWRITTEN, 1);
       }
     }
-    else{
+    free_map_release(inode->data.indirect_ptr, 1);
+  }
+  // double indirect
+  if(inode->data.double_indirect_ptr != 0){
+    cache_read_meta(inode->data.double_indirect_ptr, indirect_ptr);
+    for(i=0; i<MAX_INDIRECT_BLOCK; i++){
+      if(indirect_ptr[i] == 0){
+        continue;
+      }
+      cache_read_meta(indirect_ptr[i], block_ptr);
       for(j=0; j<MAX_INDIRECT_BLOCK; j++){
-        free_map_release(block_ptr[i], 1);
+        if(block_ptr[j] != 0){
+          free_map_release(block_ptr[j] & ~SECTOR_UNWRITTEN, 1);
+        }
       }
+      free_map_release(indirect_ptr[i], 1);
     }
-    inode->double_indirect_cnt -= MAX_INDIRECT_BLOCK;
+    free_map_release(inode->data.double_indirect_ptr, 1);
   }
   free_map_release(inode->sector, 1);
 }
@@ -462,6 +1007,8 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
 
+  inode_read_ahead(inode, offset, size);
+
   while (size > 0)
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -481,11 +1028,18 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
 
       //printf("READ IDX : %d\n", sector_idx);
-      struct cache_entry *c = cache_find_block(sector_idx); //get cache
-      if(!c){
-        c = cache_get_block(sector_idx);  // if no cache, allocate new cache
+      // unknown whether block is a hole -> read comes back short
+      if(sector_idx == SECTOR_NOMAP)
+        break;
+      // hole or unwritten block reads as zeros without I/O
+      if(sector_idx == 0 || (sector_idx & SECTOR_UNWRITTEN)){
+        memset(buffer + bytes_read, 0, chunk_size);
+      }
+      else{
+        struct cache_entry *c = cache_acquire(sector_idx, false); //get cache, pinned and shared
+        memcpy(buffer + bytes_read, c->data + sector_ofs, chunk_size);  //read data from cache
+        cache_release(c, false);
       }
-      memcpy(buffer + bytes_read, (uint8_t *)&c->data + sector_ofs, chunk_size);  //read data from cache
 
       /* Advance. */
       size -= chunk_size;
@@ -496,11 +1050,50 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
   return bytes_read;
 }
 
+/* queue logical blocks after read of SIZE bytes at OFFSET for read ahead
+  window doubles while reads are sequential, and resets on random read */
+static void inode_read_ahead(struct inode *inode, off_t offset, off_t size){
+  off_t length = inode_length(inode);
+  // sequential read
+  if(offset == inode->ra_next){
+    if(inode->ra_window < READ_AHEAD_MAX){
+      inode->ra_window *= 2;
+    }
+  }
+  // random read
+  else{
+    inode->ra_window = READ_AHEAD_MIN;
+    inode->ra_end = 0;
+  }
+  inode->ra_next = offset + size;
+
+  // blocks after the last block touched by this read
+  off_t start = ROUND_UP(offset + size, BLOCK_SECTOR_SIZE);
+  off_t end = start + (off_t) inode->ra_window * BLOCK_SECTOR_SIZE;
+  if(end > length){
+    end = length;
+  }
+  // skip blocks already queued
+  if(start < inode->ra_end){
+    start = inode->ra_end;
+  }
+  off_t pos;
+  for(pos=start; pos<end; pos+=BLOCK_SECTOR_SIZE){
+    block_sector_t sector = byte_to_sector(inode, pos);
+    if(sector != 0 && !(sector & SECTOR_UNWRITTEN)){
+      cache_read_ahead(sector);
+    }
+  }
+  if(end > inode->ra_end){
+    inode->ra_end = end;
+  }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full.
+   A write past end of file extends the inode, leaving a hole
+   between the old end and OFFSET. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
@@ -515,17 +1108,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     // if inode is file, acquire lock
     if(!inode->dir){
       inode_lock_acquire(inode);
-      inode_grow(inode, size + offset);
-      //size growth
-      inode->data.length = size + offset;
-      block_write(fs_device, inode->sector, &inode->data);
+      //size growth, new blocks are holes until written
+      //new length goes to disk after the data, see inode_sync()
+      inode->length = size + offset;
       inode_lock_release(inode);
     }
     else{
-      inode_grow(inode, size + offset);
-      //size growth
-      inode->data.length = size + offset;
-      block_write(fs_device, inode->sector, &inode->data);
+      //size growth, new blocks are holes until written
+      inode->length = size + offset;
     }
   }
 
@@ -547,13 +1137,25 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
+      // hole or unwritten block -> allocate it or mark it written,
+      // with the rest of the blocks this write covers, zeroed in the cache
+      if(sector_idx == 0 || (sector_idx & SECTOR_UNWRITTEN)){
+        sector_idx = inode_fill_hole(inode, offset / BLOCK_SECTOR_SIZE, DIV_ROUND_UP(sector_ofs + size, BLOCK_SECTOR_SIZE));
+        if(sector_idx == 0)
+          break;
+      }
+
       //printf("WRITE IDX : %d\n", sector_idx);
-      struct cache_entry *c = cache_find_block(sector_idx); //get cache
-      if(!c){
-        c = cache_get_block(sector_idx);  // if no cache, allocate new cache
+      struct cache_entry *c;
+      // whole sector is overwritten -> no need to read it first
+      if(sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE){
+        c = cache_acquire_overwrite(sector_idx);
+      }
+      else{
+        c = cache_acquire(sector_idx, true); //get cache, pinned and exclusive
       }
-      memcpy ((uint8_t *) &c->data + sector_ofs, buffer + bytes_written, chunk_size); // write data to cache
-      c->dirty = true;
+      memcpy (c->data + sector_ofs, buffer + bytes_written, chunk_size); // write data to cache
+      cache_release(c, true);
 
       /* Advance. */
       size -= chunk_size;
@@ -561,68 +1163,238 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       bytes_written += chunk_size;
     }
 
+  // data is in the cache, length may follow it to disk
+  if (offset > inode->data.length)
+    inode_mark_dirty(inode, offset);
+
   return bytes_written;
 }
 
-/* grow inode until size t */
-void inode_grow(struct inode *inode, off_t size){
-  static char zeros[BLOCK_SECTOR_SIZE];
-  block_sector_t block_ptr[MAX_INDIRECT_BLOCK];     // for indirect case
-  block_sector_t indirect_ptr[MAX_INDIRECT_BLOCK];  // for double indirect case
-  size = bytes_to_sectors(size);
-  while(size > 0){
-    //indirect growth case
-    if(inode->direct_cnt < MAX_DIRECT_BLOCK){
-      if(!free_map_allocate(1, &inode->data.direct_ptr[inode->direct_cnt]))
-        return;
-      block_write(fs_device, inode->data.direct_ptr[inode->direct_cnt], zeros);
-      inode->direct_cnt++;
-    }
-    //indirect growth case
-    else if(inode->indirect_cnt < MAX_INDIRECT_BLOCK){
-      // if indirect == 0, we have to allocate new block
-      if(inode->indirect_cnt == 0){
-        if(!free_map_allocate(1, &inode->data.indirect_ptr))
-          return;
-        block_write(fs_device, inode->data.indirect_ptr, zeros);
-      }
-      block_read(fs_device, inode->data.indirect_ptr, block_ptr);  // read block ptrs in indirect block
-      if(!free_map_allocate(1, &block_ptr[inode->indirect_cnt]))
-        return;
-      block_write(fs_device, block_ptr[inode->indirect_cnt], zeros);  // write single block ptr
-      block_write(fs_device, inode->data.indirect_ptr, block_ptr);  // write indirect block
-      inode->indirect_cnt++;
-    }
-    //double indirect growth case
-    else {
-      unsigned indirect_idx = inode->double_indirect_cnt / MAX_INDIRECT_BLOCK;
-      unsigned block_idx = inode->double_indirect_cnt % MAX_INDIRECT_BLOCK;
-      // if double_indirect == 0, we have to allocate new block
-      if(inode->double_indirect_cnt == 0){
-        if(!free_map_allocate(1, &inode->data.double_indirect_ptr))
-          return;
-        block_write(fs_device, inode->data.double_indirect_ptr, zeros);
+/* read extents of inode from inode_disk and extent blocks into block map
+  map_lock must be held, returns false if out of memory */
+static bool inode_extents_read(struct inode *inode){
+  uint32_t cnt = inode->data.extent_cnt;
+  uint32_t i, j;
+
+  for(i=0; i<cnt && i<INODE_EXTENT_CNT; i++){
+    struct block_run *run = &inode->data.extents[i];
+    if(!inode_map_append(inode, run->block, run->sector, run->cnt)){
+      return false;
+    }
+  }
+  if(i == cnt){
+    return true;
+  }
+  // rest are in extent blocks
+  struct extent_disk *ed = malloc(sizeof *ed);
+  if(ed == NULL){
+    return false;
+  }
+  block_sector_t sector = inode->data.extent_next;
+  while(i < cnt && sector != 0){
+    cache_read_meta(sector, ed);
+    for(j=0; j<ed->extent_cnt && i<cnt; j++, i++){
+      struct block_run *run = &ed->extents[j];
+      if(!inode_map_append(inode, run->block, run->sector, run->cnt)){
+        free(ed);
+        return false;
       }
-      // allocate new indirect block
-      if(inode->double_indirect_cnt % MAX_INDIRECT_BLOCK == 0){
-        block_read(fs_device, inode->data.double_indirect_ptr, indirect_ptr);
-        if(!free_map_allocate(1, &indirect_ptr[indirect_idx]))
-          return;
-        block_write(fs_device, indirect_ptr[indirect_idx], zeros);
-        block_write(fs_device, inode->data.double_indirect_ptr, indirect_ptr);
+    }
+    sector = ed->next;
+  }
+  free(ed);
+  return true;
+}
+
+/* write block map of inode as its extents
+  first extents go to inode->data, caller writes the inode sector
+  others go to chained extent blocks, which are reused or allocated
+  all extent blocks needed are allocated before anything is written, so
+  on failure the inode still holds its old extents and the caller can
+  rebuild the map from them
+  returns false if out of memory or no extent block can be allocated */
+static bool inode_extents_write(struct inode *inode){
+  struct inode_disk *disk = &inode->data;
+  uint32_t cnt = inode->map_cnt;
+  uint32_t i = cnt < INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT;
+
+  if(i < cnt){
+    struct extent_disk *ed = malloc(sizeof *ed);
+    if(ed == NULL){
+      return false;
+    }
+    block_sector_t hint = (inode->map[cnt - 1].sector & ~SECTOR_UNWRITTEN) + inode->map[cnt - 1].cnt;
+    // make the chain long enough, new blocks are linked but still empty
+    // and stay in the chain even if a later allocation fails
+    block_sector_t *link = &disk->extent_next;
+    block_sector_t sector = 0;
+    uint32_t n;
+    for(n = i; n < cnt; n += EXTENT_BLOCK_CNT){
+      if(*link == 0){
+        block_sector_t fresh;
+        if(!free_map_allocate_near(1, hint, &fresh)){
+          free(ed);
+          return false;
+        }
+        ed->extent_cnt = 0;
+        ed->next = 0;
+        cache_write_meta(fresh, ed);
+        // link it from the previous block, inode sector is written by caller
+        if(sector != 0){
+          cache_read_meta(sector, ed);
+          ed->next = fresh;
+          cache_write_meta(sector, ed);
+        }
+        else{
+          disk->extent_next = fresh;
+        }
       }
-      block_read(fs_device, inode->data.double_indirect_ptr, indirect_ptr);
-      block_read(fs_device, indirect_ptr[indirect_idx], block_ptr);
-      if(!free_map_allocate(1, &block_ptr[block_idx]))
-        return;
-      block_write(fs_device, block_ptr[block_idx], zeros);
-      block_write(fs_device, indirect_ptr[indirect_idx], block_ptr);
-      block_write(fs_device, inode->data.double_indirect_ptr, indirect_ptr);
-      inode->double_indirect_cnt++;
+      sector = *link;
+      cache_read_meta(sector, ed);
+      link = &ed->next;
     }
+    // cannot fail from here on
+    for(sector = disk->extent_next; i < cnt; sector = ed->next){
+      cache_read_meta(sector, ed);
+      n = cnt - i < EXTENT_BLOCK_CNT ? cnt - i : EXTENT_BLOCK_CNT;
+      memcpy(ed->extents, inode->map + i, n * sizeof *inode->map);
+      ed->extent_cnt = n;
+      cache_write_meta(sector, ed);
+      i += n;
+    }
+    free(ed);
+  }
+  memcpy(disk->extents, inode->map, (cnt < INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT) * sizeof *inode->map);
+  disk->extent_cnt = cnt;
+  return true;
+}
+
+/* allocate a run of up to *cnt blocks for the hole at logical block of
+  extent inode, ending at the next mapped block, right after the run
+  before it on disk if possible, halving the run if disk is fragmented
+  run is marked unwritten if unwritten is set
+  map_lock must be held, caller writes the inode sector
+  sets *cnt to the run length, returns its first sector or 0 if disk is full */
+static block_sector_t inode_alloc_extent(struct inode *inode, block_sector_t block, size_t *cnt, bool unwritten){
+  size_t i = inode_map_next(inode, block);
+  if(i < inode->map_cnt && inode->map[i].block - block < *cnt){
+    *cnt = inode->map[i].block - block;
+  }
+  // first run starts in the allocation group of inode
+  block_sector_t hint = i > 0 ? (inode->map[i - 1].sector & ~SECTOR_UNWRITTEN) + inode->map[i - 1].cnt : 0;
+  block_sector_t sector;
+  while(!(hint == 0 ? free_map_allocate_start(*cnt, inode->sector, &sector)
+                    : free_map_allocate_near(*cnt, hint, &sector))){
+    if(*cnt == 1){
+      return 0;
+    }
+    *cnt /= 2;
+  }
+  if(!inode_map_insert(inode, block, unwritten ? sector | SECTOR_UNWRITTEN : sector, *cnt)){
+    free_map_release(sector, *cnt);
+    return 0;
+  }
+  // extents on disk do not cover the run -> forget it and give it back
+  if(!inode_extents_write(inode)){
+    inode_map_reload(inode);
+    free_map_release(sector, *cnt);
+    return 0;
+  }
+  return sector;
+}
+
+/* preallocate blocks of inode for size bytes from offset, as contiguous
+  as possible, and extend inode to cover them
+  blocks are marked unwritten instead of being zeroed on disk, so they
+  read as zeros and cost no I/O until they are first written
+  if the disk fills up, the inode is extended over the blocks that were
+  preallocated, so none of them is left past end of file
+  returns false if the range is invalid or too large, the disk is full
+  or writes are denied */
+bool inode_allocate(struct inode *inode, off_t offset, off_t size){
+  bool success = true;
+
+  if(inode->deny_write_cnt || offset < 0 || size < 0 || size > INT32_MAX - offset){
+    return false;
+  }
+  off_t end_ofs = offset + size;
+  if(!inode->extent && end_ofs > MAX_FILE_SIZE){
+    return false;
+  }
+  block_sector_t block = offset / BLOCK_SECTOR_SIZE;
+  block_sector_t end = bytes_to_sectors(end_ofs);
+
+  inode_lock_acquire(inode);
+  lock_acquire(&inode->map_lock);
+  while(block < end){
+    block_sector_t sector = inode_lookup(inode, block);
+    if(sector == SECTOR_NOMAP){
+      success = false;
+      break;
+    }
+    if(sector != 0){
+      block++;
+      continue;
+    }
+    size_t cnt = end - block;
+    if(inode->extent){
+      sector = inode_alloc_extent(inode, block, &cnt, true);
+    }
+    else{
+      // run ends at the next allocated block
+      size_t n;
+      for(n=1; n<cnt && inode_lookup(inode, block + n) == 0; n++);
+      cnt = n;
+      sector = inode_prealloc_pointer(inode, block, &cnt);
+    }
+    if(sector == 0){
+      success = false;
+      break;
+    }
+    block += cnt;
+  }
+  cache_write_meta(inode->sector, &inode->data);
+  lock_release(&inode->map_lock);
+  // blocks before block are allocated, cover them if disk filled up
+  if(!success && (off_t) block * BLOCK_SECTOR_SIZE < end_ofs){
+    end_ofs = (off_t) block * BLOCK_SECTOR_SIZE;
+  }
+  // new length goes to disk lazily, like that of a write
+  bool grow = end_ofs > offset && end_ofs > inode->length;
+  if(grow){
+    inode->length = end_ofs;
+  }
+  inode_lock_release(inode);
+  if(grow){
+    inode_mark_dirty(inode, end_ofs);
+  }
+  return success;
+}
 
-    size -= 1;
+/* give back data blocks and extent blocks of extent inode */
+static void inode_free_extents(struct inode *inode){
+  size_t i;
+  // map is lost after a failed reload, data blocks leak if it stays so
+  if(!inode->map_built){
+    inode_map_build(inode);
+  }
+  for(i=0; i<inode->map_cnt; i++){
+    free_map_release(inode->map[i].sector & ~SECTOR_UNWRITTEN, inode->map[i].cnt);
+  }
+  block_sector_t sector = inode->data.extent_next;
+  if(sector == 0){
+    return;
+  }
+  struct extent_disk *ed = malloc(sizeof *ed);
+  if(ed == NULL){
+    return;
+  }
+  while(sector != 0){
+    cache_read_meta(sector, ed);
+    free_map_release(sector, 1);
+    sector = ed->next;
   }
+  free(ed);
 }
 
 /* Disables writes to INODE.
@@ -649,7 +1421,7 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  return inode->length;
 }
 
 /* Returns the dir of inode */
@@ -7,6 +7,9 @@
 
 struct bitmap;
 
+/* create new inodes mapping blocks by extents, set by -extents */
+extern bool inode_use_extents;
+
 void inode_init (void);
 bool inode_create (block_sector_t, off_t, bool, block_sector_t);
 struct inode *inode_open (block_sector_t);
@@ -16,6 +19,8 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+bool inode_allocate (struct inode *, off_t offset, off_t size);
+void inode_sync (void);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
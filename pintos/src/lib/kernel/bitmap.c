@@ -68,6 +68,64 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns the element of B numbered ELEM_IDX with each bit set
+   to 1 if the corresponding bit in B is set to VALUE and to 0
+   otherwise.  Bits past the end of B are meaningless. */
+static inline elem_type
+elem_match (const struct bitmap *b, size_t elem_idx, bool value)
+{
+  return value ? b->bits[elem_idx] : ~b->bits[elem_idx];
+}
+
+/* Returns an elem_type in which the bits at offsets FROM through
+   TO - 1 within an element are set to 1 and the rest are set to
+   0.  Requires FROM < TO <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t from, size_t to)
+{
+  elem_type high = to < ELEM_BITS ? ((elem_type) 1 << to) - 1 : (elem_type) -1;
+  return high & ~(((elem_type) 1 << from) - 1);
+}
+
+/* Returns the number of bits set to 1 in X. */
+static inline size_t
+elem_popcount (elem_type x)
+{
+  /* Sums bits in parallel in 2-, 4- and then 8-bit fields, and
+   adds up the bytes with one multiplication.  __builtin_popcount
+   would need libgcc, which the kernel doesn't link. */
+  x = x - ((x >> 1) & ((elem_type) -1 / 3));
+  x = (x & ((elem_type) -1 / 15 * 3)) + ((x >> 2) & ((elem_type) -1 / 15 * 3));
+  x = (x + (x >> 4)) & ((elem_type) -1 / 255 * 15);
+  return (x * ((elem_type) -1 / 255)) >> ((sizeof (elem_type) - 1) * CHAR_BIT);
+}
+
+/* Returns the index of the first bit in B at or after START and
+   before END that is set to VALUE, or END if there is none.
+   Examines a whole element per iteration, so runs of bits that
+   are all !VALUE are skipped ELEM_BITS at a time. */
+static size_t
+find_next (const struct bitmap *b, size_t start, size_t end, bool value)
+{
+  size_t idx, last_idx, bit;
+  elem_type word;
+
+  if (start >= end)
+    return end;
+
+  idx = elem_idx (start);
+  last_idx = elem_idx (end - 1);
+  word = elem_match (b, idx, value) & range_mask (start % ELEM_BITS, ELEM_BITS);
+  while (word == 0)
+    {
+      if (++idx > last_idx)
+        return end;
+      word = elem_match (b, idx, value);
+    }
+  bit = idx * ELEM_BITS + __builtin_ctzl (word);
+  return bit < end ? bit : end;
+}
 
 /* Creation and destruction. */
 
@@ -233,16 +291,21 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t end = start + cnt;
+  size_t value_cnt = 0;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  while (start < end)
+    {
+      size_t ofs = start % ELEM_BITS;
+      size_t n = end - start < ELEM_BITS - ofs ? end - start : ELEM_BITS - ofs;
+      value_cnt += elem_popcount (elem_match (b, elem_idx (start), value)
+                                  & range_mask (ofs, ofs + n));
+      start += n;
+    }
   return value_cnt;
 }
 
@@ -251,16 +314,11 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
-  
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
-  return false;
+  return find_next (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -299,13 +357,30 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
+  if (cnt == 0)
+    return start;
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      /* Jump to the next bit set to VALUE, then look for a bit
+         set to !VALUE within the following CNT bits.  If there is
+         one, no group can start before it, so resume from there.
+         I only moves forward, so the scan is linear in the size
+         of B rather than in its size times CNT. */
+      while (i <= last)
+        {
+          size_t end;
+
+          i = find_next (b, i, last + 1, value);
+          if (i > last)
+            break;
+          end = find_next (b, i, i + cnt, !value);
+          if (end == i + cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -359,6 +434,21 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B starting at byte OFS to the same
+   offset in FILE, clipped to the end of B.  Returns true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+                   size_t ofs, size_t size)
+{
+  size_t file_size = byte_cnt (b->bit_cnt);
+  ASSERT (ofs <= file_size);
+  if (size > file_size - ofs)
+    size = file_size - ofs;
+  return (size_t) file_write_at (file, (const uint8_t *) b->bits + ofs,
+                                 size, ofs) == size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -28,7 +28,13 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_FALLOCATE,              /* Preallocates a range of a file. */
+    SYS_CREATEAT,               /* Create a file relative to a directory fd. */
+    SYS_REMOVEAT,               /* Delete a file relative to a directory fd. */
+    SYS_OPENAT,                 /* Open a file relative to a directory fd. */
+    SYS_MKDIRAT,                /* Create a directory relative to a directory fd. */
+    SYS_GETDENTS                /* Reads many directory entries. */
   };
 
 #endif /* lib/syscall-nr.h */
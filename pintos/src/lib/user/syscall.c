@@ -182,3 +182,39 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+fallocate (int fd, unsigned offset, unsigned length)
+{
+  return syscall3 (SYS_FALLOCATE, fd, offset, length);
+}
+
+bool
+createat (int dirfd, const char *file, unsigned initial_size)
+{
+  return syscall3 (SYS_CREATEAT, dirfd, file, initial_size);
+}
+
+bool
+removeat (int dirfd, const char *file)
+{
+  return syscall2 (SYS_REMOVEAT, dirfd, file);
+}
+
+int
+openat (int dirfd, const char *file)
+{
+  return syscall2 (SYS_OPENAT, dirfd, file);
+}
+
+bool
+mkdirat (int dirfd, const char *dir)
+{
+  return syscall2 (SYS_MKDIRAT, dirfd, dir);
+}
+
+int
+getdents (int fd, struct dirent *entries, unsigned size)
+{
+  return syscall3 (SYS_GETDENTS, fd, entries, size);
+}
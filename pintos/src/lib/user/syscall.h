@@ -15,6 +15,14 @@ typedef int mapid_t;
 /* Maximum characters in a filename written by readdir(). */
 #define READDIR_MAX_LEN 14
 
+/* Directory entry written by getdents(). */
+struct dirent
+  {
+    int inumber;                        /* Inode number. */
+    bool is_dir;                        /* Is it a directory? */
+    char name[READDIR_MAX_LEN + 1];     /* Null terminated file name. */
+  };
+
 /* Typical return values from main() and arguments to exit(). */
 #define EXIT_SUCCESS 0          /* Successful execution. */
 #define EXIT_FAILURE 1          /* Unsuccessful execution. */
@@ -44,5 +52,11 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool fallocate (int fd, unsigned offset, unsigned length);
+bool createat (int dirfd, const char *file, unsigned initial_size);
+bool removeat (int dirfd, const char *file);
+int openat (int dirfd, const char *file);
+bool mkdirat (int dirfd, const char *dir);
+int getdents (int fd, struct dirent *entries, unsigned size);
 
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,37 @@
+/* Creates, opens and removes files and directories relative to
+   a directory fd with the *at calls, then checks that a fd that
+   is not a directory is rejected. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  int dir_fd;
+  int fd;
+
+  CHECK (mkdir ("a"), "mkdir \"a\"");
+  CHECK ((dir_fd = open ("a")) > 1, "open \"a\"");
+  CHECK (mkdirat (dir_fd, "b"), "mkdirat \"b\"");
+  CHECK (createat (dir_fd, "b/c", 512), "createat \"b/c\"");
+  CHECK ((fd = openat (dir_fd, "b/c")) > 1, "openat \"b/c\"");
+  CHECK (filesize (fd) == 512, "filesize \"b/c\"");
+  msg ("close \"b/c\"");
+  close (fd);
+  CHECK ((fd = open ("a/b/c")) > 1, "open \"a/b/c\"");
+  msg ("close \"a/b/c\"");
+  close (fd);
+
+  CHECK (createat (dir_fd, "d", 0), "createat \"d\"");
+  CHECK (removeat (dir_fd, "d"), "removeat \"d\"");
+  CHECK (open ("a/d") == -1, "open \"a/d\" (must return -1)");
+
+  CHECK ((fd = open ("a/b/c")) > 1, "open \"a/b/c\"");
+  CHECK (openat (fd, "c") == -1, "openat on file (must return -1)");
+  CHECK (!createat (fd, "x", 0), "createat on file (must fail)");
+  CHECK (!mkdirat (fd, "x"), "mkdirat on file (must fail)");
+  CHECK (!removeat (fd, "c"), "removeat on file (must fail)");
+  CHECK (openat (1234, "b") == -1, "openat on bad fd (must return -1)");
+}
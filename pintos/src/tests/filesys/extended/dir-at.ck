@@ -0,0 +1,27 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-at) begin
+(dir-at) mkdir "a"
+(dir-at) open "a"
+(dir-at) mkdirat "b"
+(dir-at) createat "b/c"
+(dir-at) openat "b/c"
+(dir-at) filesize "b/c"
+(dir-at) close "b/c"
+(dir-at) open "a/b/c"
+(dir-at) close "a/b/c"
+(dir-at) createat "d"
+(dir-at) removeat "d"
+(dir-at) open "a/d" (must return -1)
+(dir-at) open "a/b/c"
+(dir-at) openat on file (must return -1)
+(dir-at) createat on file (must fail)
+(dir-at) mkdirat on file (must fail)
+(dir-at) removeat on file (must fail)
+(dir-at) openat on bad fd (must return -1)
+(dir-at) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({'d' => {'sub' => {}, 'f1' => [''], 'f2' => ['']}});
+pass;
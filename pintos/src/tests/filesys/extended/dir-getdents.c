@@ -0,0 +1,70 @@
+/* Reads a directory with getdents, first into a buffer large
+   enough for every entry and then one entry at a time, and
+   checks that undersized buffers and file fds are rejected. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static void
+check_entries (const struct dirent *entries, int cnt) 
+{
+  bool seen_sub = false, seen_f1 = false, seen_f2 = false;
+  int i;
+
+  for (i = 0; i < cnt; i++) 
+    {
+      const struct dirent *e = &entries[i];
+      if (!strcmp (e->name, "sub") && e->is_dir && !seen_sub)
+        seen_sub = true;
+      else if (!strcmp (e->name, "f1") && !e->is_dir && !seen_f1)
+        seen_f1 = true;
+      else if (!strcmp (e->name, "f2") && !e->is_dir && !seen_f2)
+        seen_f2 = true;
+      else
+        fail ("unexpected entry \"%s\"", e->name);
+    }
+  if (!seen_sub || !seen_f1 || !seen_f2)
+    fail ("missing entries");
+}
+
+void
+test_main (void) 
+{
+  struct dirent entries[8];
+  int fd;
+  int i;
+
+  CHECK (mkdir ("d"), "mkdir \"d\"");
+  CHECK (mkdir ("d/sub"), "mkdir \"d/sub\"");
+  CHECK (create ("d/f1", 0), "create \"d/f1\"");
+  CHECK (create ("d/f2", 0), "create \"d/f2\"");
+
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  CHECK (getdents (fd, entries, sizeof entries) == 3,
+         "getdents \"d\" (must return 3)");
+  msg ("check entries");
+  check_entries (entries, 3);
+  CHECK (getdents (fd, entries, sizeof entries) == 0,
+         "getdents \"d\" again (must return 0)");
+  msg ("close \"d\"");
+  close (fd);
+
+  CHECK ((fd = open ("d")) > 1, "open \"d\"");
+  CHECK (getdents (fd, entries, sizeof *entries - 1) == -1,
+         "getdents with short buffer (must return -1)");
+  for (i = 0; i < 3; i++)
+    CHECK (getdents (fd, &entries[i], sizeof *entries) == 1,
+           "getdents one entry (must return 1)");
+  msg ("check entries");
+  check_entries (entries, 3);
+  CHECK (getdents (fd, entries, sizeof *entries) == 0,
+         "getdents at end (must return 0)");
+  msg ("close \"d\"");
+  close (fd);
+
+  CHECK ((fd = open ("d/f1")) > 1, "open \"d/f1\"");
+  CHECK (getdents (fd, entries, sizeof entries) == -1,
+         "getdents on file (must return -1)");
+}
@@ -0,0 +1,28 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-getdents) begin
+(dir-getdents) mkdir "d"
+(dir-getdents) mkdir "d/sub"
+(dir-getdents) create "d/f1"
+(dir-getdents) create "d/f2"
+(dir-getdents) open "d"
+(dir-getdents) getdents "d" (must return 3)
+(dir-getdents) check entries
+(dir-getdents) getdents "d" again (must return 0)
+(dir-getdents) close "d"
+(dir-getdents) open "d"
+(dir-getdents) getdents with short buffer (must return -1)
+(dir-getdents) getdents one entry (must return 1)
+(dir-getdents) getdents one entry (must return 1)
+(dir-getdents) getdents one entry (must return 1)
+(dir-getdents) check entries
+(dir-getdents) getdents at end (must return 0)
+(dir-getdents) close "d"
+(dir-getdents) open "d/f1"
+(dir-getdents) getdents on file (must return -1)
+(dir-getdents) end
+EOF
+pass;
@@ -0,0 +1,6 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_archive ({"prealloc" => ["\0" x 700 . "x" x 100 . "\0" x 1248]});
+pass;
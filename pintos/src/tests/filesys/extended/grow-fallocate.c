@@ -0,0 +1,35 @@
+/* Preallocates a range of an empty file with fallocate(), which
+   must extend the file and read as zeros, then writes into part
+   of it and checks that only the written bytes change. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[2048];
+
+void
+test_main (void) 
+{
+  const char *file_name = "prealloc";
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (fallocate (fd, 0, sizeof buf), "fallocate \"%s\"", file_name);
+  check_file_handle (fd, file_name, buf, sizeof buf);
+
+  memset (buf + 700, 'x', 100);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 700);
+  CHECK (write (fd, buf + 700, 100) == 100, "write \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, sizeof buf);
+
+  CHECK (!fallocate (fd, 0x40000000, 0x40000000),
+         "fallocate overflowing range (must fail)");
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
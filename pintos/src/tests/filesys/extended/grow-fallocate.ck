@@ -0,0 +1,19 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-fallocate) begin
+(grow-fallocate) create "prealloc"
+(grow-fallocate) open "prealloc"
+(grow-fallocate) fallocate "prealloc"
+(grow-fallocate) verified contents of "prealloc"
+(grow-fallocate) seek "prealloc"
+(grow-fallocate) write "prealloc"
+(grow-fallocate) seek "prealloc"
+(grow-fallocate) verified contents of "prealloc"
+(grow-fallocate) fallocate overflowing range (must fail)
+(grow-fallocate) close "prealloc"
+(grow-fallocate) end
+EOF
+pass;
@@ -42,6 +42,7 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -259,6 +260,19 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        {
+          if (value != NULL && !strcmp (value, "fifo"))
+            cache_policy = CACHE_FIFO;
+          else if (value != NULL && !strcmp (value, "clock"))
+            cache_policy = CACHE_CLOCK;
+          else
+            PANIC ("unknown cache policy `%s' (use fifo or clock)", value);
+        }
+      else if (!strcmp (name, "-cache-meta"))
+        cache_meta_priority = true;
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -385,6 +399,9 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=POLICY      Use POLICY (fifo or clock) for buffer cache.\n"
+          "  -cache-meta        Evict file data before metadata in buffer cache.\n"
+          "  -extents           Create files with extent-based inodes.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -25,10 +25,16 @@ static void syscall_handler (struct intr_frame *);
 #define PRINT 0    //for debugging
 
 #define MAX_DIRECTORY_CNT 5
+#define GETDENTS_BATCH_CNT 16   //entries read from dir per batch
 
 void check_addr(void* vaddr);
 static uintptr_t* get_arg(void* esp, int num);
 static struct file *get_file_by_fd(int fd);
+static struct dir *get_dir_by_fd(int fd);
+static bool create_in(struct dir *dir, const char *file, unsigned initial_size);
+static bool remove_in(struct dir *dir, const char *file);
+static int open_in(struct dir *dir, const char *file);
+static bool mkdir_in(struct dir *start, const char *dir_);
 
 
 //to save in file_list in thread
@@ -172,6 +178,42 @@ syscall_handler (struct intr_frame *f UNUSED)
         printf("\nSYS_INUMBER\n");
       f->eax = inumber ((int) *get_arg(esp, 0));
       break;
+
+    case SYS_FALLOCATE:
+      if(PRINT)
+        printf("\nSYS_FALLOCATE\n");
+      f->eax = fallocate ((int) *get_arg(esp, 0), (unsigned) *get_arg(esp, 1), (unsigned) *get_arg(esp, 2));
+      break;
+
+    case SYS_CREATEAT:
+      if(PRINT)
+        printf("\nSYS_CREATEAT\n");
+      f->eax = createat ((int) *get_arg(esp, 0), (const char *) *get_arg(esp, 1), (unsigned) *get_arg(esp, 2));
+      break;
+
+    case SYS_REMOVEAT:
+      if(PRINT)
+        printf("\nSYS_REMOVEAT\n");
+      f->eax = removeat ((int) *get_arg(esp, 0), (const char *) *get_arg(esp, 1));
+      break;
+
+    case SYS_OPENAT:
+      if(PRINT)
+        printf("\nSYS_OPENAT\n");
+      f->eax = openat ((int) *get_arg(esp, 0), (const char *) *get_arg(esp, 1));
+      break;
+
+    case SYS_MKDIRAT:
+      if(PRINT)
+        printf("\nSYS_MKDIRAT\n");
+      f->eax = mkdirat ((int) *get_arg(esp, 0), (const char *) *get_arg(esp, 1));
+      break;
+
+    case SYS_GETDENTS:
+      if(PRINT)
+        printf("\nSYS_GETDENTS\n");
+      f->eax = getdents ((int) *get_arg(esp, 0), (struct dirent *) *get_arg(esp, 1), (unsigned) *get_arg(esp, 2));
+      break;
   }
 }
 
@@ -205,28 +247,46 @@ int wait (pid_t pid){
 
 
 bool create (const char *file, unsigned initial_size){
+  return create_in(NULL, file, initial_size);
+}
+
+
+// create file relative to dir, or current directory if dir is NULL
+static bool create_in(struct dir *dir, const char *file, unsigned initial_size){
   //if file name is NULL
   if(!strcmp(file, "")){
     exit(-1);
   }
   //create file
   lock_acquire(&file_lock);
-  bool b = filesys_create(file, initial_size);
+  bool b = filesys_create_at(dir, file, initial_size);
   lock_release(&file_lock);
   return b;
 }
 
 
 bool remove (const char *file){
+  return remove_in(NULL, file);
+}
+
+
+// remove file relative to dir, or current directory if dir is NULL
+static bool remove_in(struct dir *dir, const char *file){
   //remove file
   lock_acquire(&file_lock);
-  bool b = filesys_remove(file);
+  bool b = filesys_remove_at(dir, file);
   lock_release(&file_lock);
   return b;
 }
 
 
 int open (const char *file){
+  return open_in(NULL, file);
+}
+
+
+// open file relative to dir, or current directory if dir is NULL
+static int open_in(struct dir *dir, const char *file){
   lock_acquire(&file_lock);
   //if file is NULL
   if(!strcmp(file, "")){
@@ -236,7 +296,7 @@ int open (const char *file){
   //if file is not null
   else{
     //open file
-    struct file *f = filesys_open(file);
+    struct file *f = filesys_open_at(dir, file);
     //if f is NULL
     if(f == NULL){
       lock_release(&file_lock);
@@ -463,113 +523,45 @@ bool chdir (const char *dir_){
   if(!strcmp(dir_, "")){
     return true;
   }
-  else{
-    struct dir *dir = NULL;
-    // absolute path
-    if(dir_[0] == '/'){
-      dir = dir_absolute_path(dir_);
-    }
-    // relative path
-    else{
-      dir = dir_relative_path(dir_);
-    }
-
-    // if no dir available
-    if(!dir){
-      return false;
-    }
-
-    // get name of file
-    char temp_path[FILE_NAME_MAX_LENGTH];
-    char *argv[ARGS_MAX_LENGTH];
-    int argc=0;
-    strlcpy(temp_path, dir_, FILE_NAME_MAX_LENGTH);
-    parse_dir_path(temp_path, argv, &argc);
-
-    struct inode *inode;
-    if(argc == 0){
-      if(!strcmp(argv[argc-1], "/")){
-        dir_close(thread_current()->dir);
-        thread_current()->dir = dir_open_root();
-        return true;
-      }
-    }
-    else{
-      if(!strcmp(argv[argc-1], "..")){
-        inode = dir_get_inode(dir);
-        block_sector_t parent_sector = inode_get_parent_sector(inode);
-        dir_close(dir);
-        inode = inode_open(parent_sector);
-        dir = dir_open(inode);
-        dir_close(thread_current()->dir);
-        thread_current()->dir = dir;
-        return true;
-      }
-      dir_lookup(dir, argv[argc-1], &inode);
-      // if there is file in dir
-      if(inode){
-        // if folder
-        if(inode_get_dir(inode)){
-          dir_close(dir);
-          dir = dir_open(inode);
-          dir_close(thread_current()->dir);   // close current directory
-          thread_current()->dir = dir;        // set current directory
-          return true;
-        }
-        // if file
-        else{
-          inode_close(inode);
-          dir_close(dir);
-          return false;
-        }
-      }
-      // if no file name in dir
-      else{
-        dir_close(dir);
-        return false;
-      }
-    }
+  char name[NAME_MAX + 1];
+  struct inode *inode;
+  dir_close(dir_namei(NULL, dir_, name, &inode));
+  // if no file, or file is not a folder
+  if(inode == NULL || !inode_get_dir(inode)){
+    inode_close(inode);
+    return false;
   }
+  dir_close(thread_current()->dir);             // close current directory
+  thread_current()->dir = dir_open(inode);      // set current directory
+  return true;
 }
 
 
 bool mkdir (const char *dir_){
+  return mkdir_in(NULL, dir_);
+}
+
+
+// make directory relative to start, or current directory if start is NULL
+static bool mkdir_in(struct dir *start, const char *dir_){
   // if dir is NULL
   if(!strcmp(dir_, "")){
     return false;
   }
-  else{
-    block_sector_t inode_sector = 0;
-    struct dir *dir = NULL;
-    // absolute path
-    if(dir_[0] == '/'){
-      dir = dir_absolute_path(dir_);
-    }
-    // relative path
-    else{
-      dir = dir_relative_path(dir_);
-    }
-
-    // get name of file
-    char temp_path[FILE_NAME_MAX_LENGTH];
-    char *argv[ARGS_MAX_LENGTH];
-    int argc=0;
-    strlcpy(temp_path, dir_, FILE_NAME_MAX_LENGTH);
-    parse_dir_path(temp_path, argv, &argc);
-
-    struct inode *parent = dir_get_inode(dir);
-    block_sector_t parent_sector = inode_get_sector(parent);
-
-    bool success = (dir != NULL
-                    && free_map_allocate (1, &inode_sector)
-                    && dir_create (inode_sector, MAX_DIRECTORY_CNT, parent_sector)
-                    && dir_add (dir, argv[argc-1], inode_sector));
-    if (!success && inode_sector != 0)
-      free_map_release (inode_sector, 1);
-    dir_close(dir);
-
-    return success;
-  }
+  block_sector_t inode_sector = 0;
+  char name[NAME_MAX + 1];
+  struct dir *dir = dir_namei(start, dir_, name, NULL);
+  block_sector_t parent_sector = dir != NULL ? inode_get_sector(dir_get_inode(dir)) : 0;
+
+  bool success = (dir != NULL
+                  && free_map_allocate_spread (1, &inode_sector)
+                  && dir_create (inode_sector, MAX_DIRECTORY_CNT, parent_sector)
+                  && dir_add (dir, name, inode_sector, true));
+  if (!success && inode_sector != 0)
+    free_map_release (inode_sector, 1);
+  dir_close(dir);
+
+  return success;
 }
 
 
@@ -619,6 +611,97 @@ int inumber (int fd){
 }
 
 
+bool fallocate (int fd, unsigned offset, unsigned length){
+  lock_acquire(&file_lock);
+  struct file *f = get_file_by_fd(fd);
+  // no file in fd, or fd is directory
+  if(f == NULL || inode_get_dir(file_get_inode(f))){
+    lock_release(&file_lock);
+    return false;
+  }
+  // preallocate without zeroing, reads see zeros until written
+  bool b = file_allocate(f, offset, length);
+  lock_release(&file_lock);
+  return b;
+}
+
+
+bool createat (int dirfd, const char *file, unsigned initial_size){
+  struct dir *dir = get_dir_by_fd(dirfd);
+  // dirfd is not a directory
+  if(dir == NULL){
+    return false;
+  }
+  return create_in(dir, file, initial_size);
+}
+
+
+bool removeat (int dirfd, const char *file){
+  struct dir *dir = get_dir_by_fd(dirfd);
+  // dirfd is not a directory
+  if(dir == NULL){
+    return false;
+  }
+  return remove_in(dir, file);
+}
+
+
+int openat (int dirfd, const char *file){
+  struct dir *dir = get_dir_by_fd(dirfd);
+  // dirfd is not a directory
+  if(dir == NULL){
+    return -1;
+  }
+  return open_in(dir, file);
+}
+
+
+bool mkdirat (int dirfd, const char *dir_){
+  struct dir *dir = get_dir_by_fd(dirfd);
+  // dirfd is not a directory
+  if(dir == NULL){
+    return false;
+  }
+  return mkdir_in(dir, dir_);
+}
+
+
+int getdents (int fd, struct dirent *entries, unsigned size){
+  struct dir_info info[GETDENTS_BATCH_CNT];
+  unsigned cnt = size / sizeof *entries;
+  unsigned n = 0;
+
+  //if writing kernel vaddr
+  if(is_kernel_vaddr((void *) entries + size)){
+    exit(-1);
+  }
+  struct dir *dir = get_dir_by_fd(fd);
+  // fd is not a directory
+  if(dir == NULL){
+    return -1;
+  }
+  // buffer cannot hold a single entry
+  if(cnt == 0){
+    return -1;
+  }
+  // fill as many entries as fit, a batch at a time
+  while(n < cnt){
+    unsigned want = cnt - n < GETDENTS_BATCH_CNT ? cnt - n : GETDENTS_BATCH_CNT;
+    size_t got = dir_readdir_batch(dir, info, want);
+    size_t i;
+    if(got == 0){
+      break;
+    }
+    for(i = 0; i < got; i++, n++){
+      entries[n].inumber = info[i].inode_sector;
+      entries[n].is_dir = info[i].is_dir;
+      strlcpy(entries[n].name, info[i].name, sizeof entries[n].name);
+    }
+  }
+  return n;
+}
+
+
 //check whether vaddr is valid addr, if not, exit
 void check_addr(void* vaddr){
   if(is_kernel_vaddr(vaddr)){
@@ -647,6 +730,16 @@ static struct file *get_file_by_fd(int fd){
   return NULL;
 }
 
+//return directory open as fd, NULL if fd is not a directory
+static struct dir *get_dir_by_fd(int fd){
+  struct file *f = get_file_by_fd(fd);
+  if(f == NULL || !inode_get_dir(file_get_inode(f))){
+    return NULL;
+  }
+  // directory fds are read as struct dir, same as readdir
+  return (struct dir *) f;
+}
+
 //close all files in current thread
 void close_all(void){
   struct thread *t = thread_current();